@@ -311,6 +311,15 @@ void fp2inv1271(f2elm_t a);
 // Normalize projective twisted Edwards point Q = (X,Y,Z) -> P = (x,y)
 void eccnorm(point_extproj_t P, point_t Q);
 
+// Simultaneous normalization of projective twisted Edwards points P[i] = (X,Y,Z) -> Q[i] = (x,y) using a single inversion
+void eccnorm_batch(point_extproj_t* P, point_t* Q, unsigned int npoints);
+
+// Simultaneous affine sums R[k] = Q[k][0]+...+Q[k][n-1], k = 0,...,nsums-1, reduced level by level with one inversion per level
+void ecc_sum_affine_batch(point_precomp **Q[], unsigned int nsums, unsigned int n, point_t *R, point_precomp *work, f2elm_t *scratch);
+
+// Equality test of projective twisted Edwards points P = (X1,Y1,Z1) and Q = (X2,Y2,Z2) by cross-multiplication, without inversion
+bool ecc_equal_extproj(point_extproj_t P, point_extproj_t Q);
+
 // Conversion from representation (X,Y,Z,Ta,Tb) to (X+Y,Y-X,2Z,2dT), where T = Ta*Tb
 void R1_to_R2(point_extproj_t P, point_extproj_precomp_t Q);
 
@@ -370,6 +379,19 @@ const char* FourQ_get_error_message(ECCRYPTO_STATUS Status);
 // Mixed point addition P = P+Q or P = P+P
 void eccmadd_ni(point_precomp_t Q, point_extproj_t P);
 
+// Point conversion from affine coordinates to representation (x+y,y-x,2dt), used as input to mixed point addition
+void point_setup_precomp(point_t P, point_precomp_t Q);
+
+// Conversion from representation (x+y,y-x,2dt) to (X,Y,Z,Ta,Tb)
+void R5_to_R1(point_precomp_t P, point_extproj_t Q);
+
+// Four independent sums of precomputed points R[k] = Q[k][0]+...+Q[k][n-1], computed in parallel lanes with AVX2
+void eccmadd_sum_x4(point_precomp **Q[4], unsigned int n, point_extproj_t R[4]);
+
+// Up to MADD_MAX_LANES independent sums of precomputed points R[k] = Q[k][0]+...+Q[k][n-1], k < lanes, interleaved step by step
+#define MADD_MAX_LANES 4
+void eccmadd_sum_interleaved(point_precomp **Q[], unsigned int lanes, unsigned int n, point_extproj_t R[]);
+
 // Constant-time table lookup to extract a point represented as (x+y,y-x,2t)
 void table_lookup_fixed_base(point_precomp_t* table, point_precomp_t P, unsigned int digit, unsigned int sign);
 
@@ -379,6 +401,9 @@ void mLSB_set_recode(uint64_t* scalar, unsigned int *digits);
 // Generation of the precomputation table used internally by the double scalar multiplication function ecc_mul_double()
 void ecc_precomp_double(point_extproj_t P, point_extproj_precomp_t* Table, unsigned int npoints);
 
+// Double scalar multiplication T = k*G + l*Q with output in representation (X,Y,Z,Ta,Tb), i.e., ecc_mul_double() without the final inversion
+bool ecc_mul_double_extproj(digit_t* k, point_t Q, digit_t* l, point_extproj_t T);
+
 // Computes wNAF recoding of a scalar
 void wNAF_recode(uint64_t scalar, unsigned int w, int* digits);
 
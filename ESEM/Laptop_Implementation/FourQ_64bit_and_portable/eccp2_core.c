@@ -21,6 +21,9 @@
 #elif (TARGET == TARGET_ARM64)
     #include "ARM64/fp_arm64.h"
 #endif
+#if (SIMD_SUPPORT == AVX2_SUPPORT)
+    #include <immintrin.h>
+#endif
 
 
 /***********************************************/
@@ -176,6 +179,143 @@ void eccnorm(point_extproj_t P, point_t Q)
 }
 
 
+void eccnorm_batch(point_extproj_t* P, point_t* Q, unsigned int npoints)
+{ // Simultaneous normalization of "npoints" projective points (X1:Y1:Z1), including full reduction
+  // Uses Montgomery's trick, i.e., a single inversion and 3*(npoints-1) extra multiplications in total
+  // Input: P[i] = (Xi:Yi:Zi) in twisted Edwards coordinates, i = 0,...,npoints-1 (P is not modified)    
+  // Output: Q[i] = (Xi/Zi,Yi/Zi), corresponding to (Xi:Yi:Zi:Ti) in extended twisted Edwards coordinates
+    f2elm_t t1, t2;
+    unsigned int i;
+
+    if (npoints == 0) return;
+
+    fp2copy1271(P[0]->z, Q[0]->x);                     // Q[i]->x = Z0*...*Zi is used as scratch
+    for (i = 1; i < npoints; i++) {
+        fp2mul1271(Q[i-1]->x, P[i]->z, Q[i]->x);
+    }
+    fp2copy1271(Q[npoints-1]->x, t1);
+    fp2inv1271(t1);                                    // t1 = (Z0*...*Zn-1)^-1
+
+    for (i = npoints-1; i > 0; i--) {
+        fp2mul1271(t1, Q[i-1]->x, t2);                 // t2 = Zi^-1
+        fp2mul1271(t1, P[i]->z, t1);                   // t1 = (Z0*...*Zi-1)^-1
+        fp2mul1271(P[i]->x, t2, Q[i]->x);              // Xi = Xi/Zi
+        fp2mul1271(P[i]->y, t2, Q[i]->y);              // Yi = Yi/Zi
+        mod1271(Q[i]->x[0]); mod1271(Q[i]->x[1]); 
+        mod1271(Q[i]->y[0]); mod1271(Q[i]->y[1]); 
+    }
+    fp2mul1271(P[0]->x, t1, Q[0]->x);                  // X0 = X0/Z0
+    fp2mul1271(P[0]->y, t1, Q[0]->y);                  // Y0 = Y0/Z0
+    mod1271(Q[0]->x[0]); mod1271(Q[0]->x[1]); 
+    mod1271(Q[0]->y[0]); mod1271(Q[0]->y[1]); 
+#ifdef TEMP_ZEROING
+    clear_words((void*)t1, sizeof(f2elm_t)/sizeof(unsigned int));
+    clear_words((void*)t2, sizeof(f2elm_t)/sizeof(unsigned int));
+#endif
+}
+
+
+void ecc_sum_affine_batch(point_precomp **Q[], unsigned int nsums, unsigned int n, point_t *R, point_precomp *work, f2elm_t *scratch)
+{ // Simultaneous computation of "nsums" sums of n > 0 points in representation (x+y,y-x,2dt), e.g., entries of precomputed tables
+  // The sums are reduced as binary trees, all of them one level at a time. Every addition of a level is done in affine
+  // coordinates: (x3,y3) = ((B-A)/(2+C),(B+A)/(2-C)) with A = (y1-x1)(y2-x2), B = (x1+y1)(x2+y2) and C = 2dt1t2, where
+  // the inverses of all (2-C)(2+C) of the level are obtained with Montgomery's trick from a single inversion.
+  // Complete for points in the prime-order subgroup, since d is not a square in GF(p^2).
+  // Inputs: Q[k][i] = (x+y,y-x,2dt), work with room for nsums*ceil(n/2) points, scratch with room for 3*nsums*floor(n/2) elements
+  // Output: R[k] = (x,y) in affine coordinates, including full reduction
+    f2elm_t t1, t2, u, two = {0};
+    f2elm_t *G = scratch, *D = scratch + nsums*(n/2), *M = scratch + 2*nsums*(n/2);
+    point_precomp *P1, *P2, *S;
+    unsigned int k, j, cnt, pairs, m, nadd, stride = (n + 1)/2;
+
+    if (nsums == 0) return;
+
+    two[0][0] = 2;
+    if (n == 1) {
+        for (k = 0; k < nsums; k++) {                      // x = ((x+y)-(y-x))/2, y = ((x+y)+(y-x))/2
+            fp2sub1271(Q[k][0]->xy, Q[k][0]->yx, R[k]->x);
+            fp2add1271(Q[k][0]->xy, Q[k][0]->yx, R[k]->y);
+            fp2div1271(R[k]->x);
+            fp2div1271(R[k]->y);
+            mod1271(R[k]->x[0]); mod1271(R[k]->x[1]);
+            mod1271(R[k]->y[0]); mod1271(R[k]->y[1]);
+        }
+        return;
+    }
+
+    for (cnt = n; cnt > 1; cnt = pairs + (cnt & 1)) {
+        pairs = cnt/2;
+        nadd = nsums*pairs;
+        for (k = 0, m = 0; k < nsums; k++) {               // Numerators and denominators, in place in work from the second level on
+            for (j = 0; j < pairs; j++, m++) {
+                P1 = (cnt == n) ? Q[k][2*j] : &work[k*stride + 2*j];
+                P2 = (cnt == n) ? Q[k][2*j+1] : &work[k*stride + 2*j+1];
+                S = &work[k*stride + j];
+                fp2mul1271(P1->yx, P2->yx, t1);               // t1 = A
+                fp2mul1271(P1->xy, P2->xy, t2);               // t2 = B
+                fp2mul1271(P1->t2, P2->t2, u);
+                fp2mul1271(u, (felm_t*)&PARAMETER_2d_inv, u); // u = C = (2dt1)(2dt2)/(2d)
+                fp2sub1271(t2, t1, S->xy);                    // S.xy = B-A
+                fp2add1271(t2, t1, S->yx);                    // S.yx = B+A
+                fp2sub1271(two, u, S->t2);                    // S.t2 = 2-C
+                fp2add1271(two, u, G[m]);                     // G = 2+C
+                fp2mul1271(S->t2, G[m], D[m]);                // D = (2-C)(2+C)
+                if (m == 0) {
+                    fp2copy1271(D[0], M[0]);                  // M[m] = D[0]*...*D[m]
+                } else {
+                    fp2mul1271(M[m-1], D[m], M[m]);
+                }
+            }
+            if (cnt & 1) {                                 // The odd point out moves up a level as it is
+                S = &work[k*stride + pairs];
+                P1 = (cnt == n) ? Q[k][cnt-1] : &work[k*stride + cnt-1];
+                if (S != P1) {
+                    fp2copy1271(P1->xy, S->xy);
+                    fp2copy1271(P1->yx, S->yx);
+                    fp2copy1271(P1->t2, S->t2);
+                }
+            }
+        }
+
+        fp2copy1271(M[nadd-1], t1);
+        fp2inv1271(t1);                                    // t1 = (D[0]*...*D[nadd-1])^-1
+        for (k = nsums; k-- > 0;) {
+            for (j = pairs; j-- > 0;) {
+                m = k*pairs + j;
+                if (m == 0) {
+                    fp2copy1271(t1, u);                       // u = D[0]^-1
+                } else {
+                    fp2mul1271(t1, M[m-1], u);                // u = D[m]^-1
+                    fp2mul1271(t1, D[m], t1);                 // t1 = (D[0]*...*D[m-1])^-1
+                }
+                S = &work[k*stride + j];
+                fp2mul1271(u, S->t2, t2);                     // t2 = 1/(2+C)
+                fp2mul1271(u, G[m], u);                       // u = 1/(2-C)
+                if (cnt == 2) {
+                    fp2mul1271(S->xy, t2, R[k]->x);           // x3 = (B-A)/(2+C)
+                    fp2mul1271(S->yx, u, R[k]->y);            // y3 = (B+A)/(2-C)
+                    mod1271(R[k]->x[0]); mod1271(R[k]->x[1]);
+                    mod1271(R[k]->y[0]); mod1271(R[k]->y[1]);
+                } else {
+                    fp2mul1271(S->xy, t2, t2);                // t2 = x3
+                    fp2mul1271(S->yx, u, u);                  // u = y3
+                    fp2add1271(t2, u, S->xy);                 // S = (x3+y3,y3-x3,2dx3y3)
+                    fp2sub1271(u, t2, S->yx);
+                    fp2mul1271(t2, u, S->t2);
+                    fp2add1271(S->t2, S->t2, S->t2);
+                    fp2mul1271(S->t2, (felm_t*)&PARAMETER_d, S->t2);
+                }
+            }
+        }
+    }
+#ifdef TEMP_ZEROING
+    clear_words((void*)t1, sizeof(f2elm_t)/sizeof(unsigned int));
+    clear_words((void*)t2, sizeof(f2elm_t)/sizeof(unsigned int));
+    clear_words((void*)u, sizeof(f2elm_t)/sizeof(unsigned int));
+#endif
+}
+
+
 __inline void R1_to_R2(point_extproj_t P, point_extproj_precomp_t Q) 
 { // Conversion from representation (X,Y,Z,Ta,Tb) to (X+Y,Y-X,2Z,2dT), where T = Ta*Tb
   // Input:  P = (X1,Y1,Z1,Ta,Tb), where T1 = Ta*Tb, corresponding to (X1:Y1:Z1:T1) in extended twisted Edwards coordinates
@@ -295,6 +435,19 @@ __inline void point_setup(point_t P, point_extproj_t Q)
 }
 
 
+__inline void point_setup_precomp(point_t P, point_precomp_t Q)
+{ // Point conversion to representation (x+y,y-x,2dt)
+  // Input: P = (x,y) in affine coordinates
+  // Output: Q = (x+y,y-x,2dt), where t=x*y, corresponding to (X:Y:Z:T) in extended twisted Edwards coordinates, where Z=1
+
+    fp2add1271(P->x, P->y, Q->xy);                    // QX = x+y
+    fp2sub1271(P->y, P->x, Q->yx);                    // QY = y-x
+    fp2mul1271(P->x, P->y, Q->t2);                    // T = x*y
+    fp2add1271(Q->t2, Q->t2, Q->t2);                  // T = 2*T
+    fp2mul1271(Q->t2, (felm_t*)&PARAMETER_d, Q->t2);  // QT = 2dt
+}
+
+
 __inline bool ecc_point_validate(point_extproj_t P)
 { // Point validation: check if point lies on the curve
   // Input: P = (x,y) in affine coordinates, where x, y in [0, 2^127-1]. 
@@ -330,7 +483,7 @@ __inline bool ecc_point_validate(point_extproj_t P)
 }
 
 
-static __inline void R5_to_R1(point_precomp_t P, point_extproj_t Q)      
+__inline void R5_to_R1(point_precomp_t P, point_extproj_t Q)      
 { // Conversion from representation (x+y,y-x,2dt) to (X,Y,Z,Ta,Tb) 
   // Input:  P = (x1+y1,y1-x1,2dt1) corresponding to (X1:Y1:Z1:T1) in extended twisted Edwards coordinates, where Z1=1
   // Output: Q = (x1,y1,z1,x1,y1), where z1=1, corresponding to (X1:Y1:Z1:T1) in extended twisted Edwards coordinates 
@@ -380,6 +533,257 @@ void eccmadd_ni(point_precomp_t Q, point_extproj_t P)
 }
 
 
+void eccmadd_sum_interleaved(point_precomp **Q[], unsigned int lanes, unsigned int n, point_extproj_t R[])
+{ // Up to MADD_MAX_LANES independent sums of precomputed points, R[k] = Q[k][0]+...+Q[k][n-1] for k < lanes, with n > 0.
+  // Each step of eccmadd is applied to every lane before the next one, so the out-of-order core overlaps the field
+  // operations of the lanes instead of waiting on a single chain of dependent additions.
+  // Output: R[k] = (X,Y,Z,Ta,Tb)
+    f2elm_t t1[MADD_MAX_LANES], t2[MADD_MAX_LANES];
+    point_precomp *q;
+    unsigned int i, k;
+
+    for (k = 0; k < lanes; k++) {
+        R5_to_R1(Q[k][0], R[k]);
+    }
+    for (i = 1; i < n; i++) {
+        for (k = 0; k < lanes; k++) fp2mul1271(R[k]->ta, R[k]->tb, R[k]->ta);       // Ta = T1
+        for (k = 0; k < lanes; k++) fp2add1271(R[k]->z, R[k]->z, t1[k]);            // t1 = 2Z1
+        for (k = 0; k < lanes; k++) fp2mul1271(R[k]->ta, Q[k][i]->t2, R[k]->ta);    // Ta = 2dT1*t2
+        for (k = 0; k < lanes; k++) {
+            fp2add1271(R[k]->x, R[k]->y, R[k]->z);                                  // Z = (X1+Y1)
+            fp2sub1271(R[k]->y, R[k]->x, R[k]->tb);                                 // Tb = (Y1-X1)
+            fp2sub1271(t1[k], R[k]->ta, t2[k]);                                     // t2 = theta
+            fp2add1271(t1[k], R[k]->ta, t1[k]);                                     // t1 = alpha
+        }
+        for (k = 0; k < lanes; k++) {
+            q = Q[k][i];
+            fp2mul1271(q->xy, R[k]->z, R[k]->ta);                                   // Ta = (X1+Y1)(x2+y2)
+            fp2mul1271(q->yx, R[k]->tb, R[k]->x);                                   // X = (Y1-X1)(y2-x2)
+        }
+        for (k = 0; k < lanes; k++) fp2mul1271(t1[k], t2[k], R[k]->z);              // Zfinal = theta*alpha
+        for (k = 0; k < lanes; k++) {
+            fp2sub1271(R[k]->ta, R[k]->x, R[k]->tb);                                // Tbfinal = beta
+            fp2add1271(R[k]->ta, R[k]->x, R[k]->ta);                                // Tafinal = omega
+        }
+        for (k = 0; k < lanes; k++) fp2mul1271(R[k]->tb, t2[k], R[k]->x);           // Xfinal = beta*theta
+        for (k = 0; k < lanes; k++) fp2mul1271(R[k]->ta, t1[k], R[k]->y);           // Yfinal = alpha*omega
+    }
+#ifdef TEMP_ZEROING
+    clear_words((void*)t1, sizeof(t1)/sizeof(unsigned int));
+    clear_words((void*)t2, sizeof(t2)/sizeof(unsigned int));
+#endif
+}
+
+
+#if (SIMD_SUPPORT == AVX2_SUPPORT)
+
+// Four GF(p) elements, one per 64-bit lane, in radix 2^26: limb i holds bits 26i..26i+25. Limbs are kept below 2^29
+// between operations, so multiplications by 8*limb fit the 32-bit inputs of vpmuludq and sums of products fit 64 bits.
+typedef __m256i v4felm_t[5];
+typedef v4felm_t v4f2elm_t[2];
+typedef struct { v4f2elm_t x; v4f2elm_t y; v4f2elm_t z; v4f2elm_t ta; v4f2elm_t tb; } v4point_extproj;
+typedef struct { v4f2elm_t xy; v4f2elm_t yx; v4f2elm_t t2; } v4point_precomp;
+
+#define V4_MASK26    _mm256_set1_epi64x(0x3FFFFFF)
+
+
+static __inline void v4fpcarry1271(v4felm_t a)
+{ // Carry propagation, limbs of the output are below 2^26+2^13. Uses 2^130 = 8 (mod p)
+    __m256i c;
+    unsigned int i;
+
+    for (i = 0; i < 4; i++) {
+        c = _mm256_srli_epi64(a[i], 26);
+        a[i] = _mm256_and_si256(a[i], V4_MASK26);
+        a[i+1] = _mm256_add_epi64(a[i+1], c);
+    }
+    c = _mm256_srli_epi64(a[4], 26);
+    a[4] = _mm256_and_si256(a[4], V4_MASK26);
+    a[0] = _mm256_add_epi64(a[0], _mm256_slli_epi64(c, 3));
+    c = _mm256_srli_epi64(a[0], 26);
+    a[0] = _mm256_and_si256(a[0], V4_MASK26);
+    a[1] = _mm256_add_epi64(a[1], c);
+}
+
+
+static __inline void v4fp2add1271(v4f2elm_t a, v4f2elm_t b, v4f2elm_t c)
+{ // c = a+b, without carry propagation
+    unsigned int i;
+
+    for (i = 0; i < 5; i++) {
+        c[0][i] = _mm256_add_epi64(a[0][i], b[0][i]);
+        c[1][i] = _mm256_add_epi64(a[1][i], b[1][i]);
+    }
+}
+
+
+static __inline void v4fpsub1271(v4felm_t a, v4felm_t b, v4felm_t c)
+{ // c = a-b+16p, where 16p = (2^27-16, 2^27-2, 2^27-2, 2^27-2, 2^27-2) in radix 2^26. Limbs of b must be carried
+    unsigned int i;
+
+    c[0] = _mm256_sub_epi64(_mm256_add_epi64(a[0], _mm256_set1_epi64x(0x7FFFFF0)), b[0]);
+    for (i = 1; i < 5; i++) {
+        c[i] = _mm256_sub_epi64(_mm256_add_epi64(a[i], _mm256_set1_epi64x(0x7FFFFFE)), b[i]);
+    }
+}
+
+
+static __inline void v4fp2sub1271(v4f2elm_t a, v4f2elm_t b, v4f2elm_t c)
+{ // c = a-b, without carry propagation. Limbs of b must be carried
+    v4fpsub1271(a[0], b[0], c[0]);
+    v4fpsub1271(a[1], b[1], c[1]);
+}
+
+
+static __inline void v4fpmul1271_unreduced(v4felm_t a, v4felm_t b, v4felm_t c)
+{ // c = a*b with 64-bit limbs, before carry propagation. Products with weight 2^130 or more are folded back times 8
+    v4felm_t b8;
+    unsigned int i, j;
+
+    for (j = 1; j < 5; j++) {
+        b8[j] = _mm256_slli_epi64(b[j], 3);
+    }
+    for (i = 0; i < 5; i++) {
+        c[i] = _mm256_mul_epu32(a[i], b[0]);
+        for (j = 1; j <= i; j++) {
+            c[i] = _mm256_add_epi64(c[i], _mm256_mul_epu32(a[i-j], b[j]));
+        }
+        for (j = i+1; j < 5; j++) {
+            c[i] = _mm256_add_epi64(c[i], _mm256_mul_epu32(a[i+5-j], b8[j]));
+        }
+    }
+}
+
+
+static __inline void v4fp2mul1271(v4f2elm_t a, v4f2elm_t b, v4f2elm_t c)
+{ // c = a*b = (a0*b0-a1*b1) + (a0*b1+a1*b0)*i, with carried output
+    v4felm_t t00, t11, t01, t10;
+    unsigned int i;
+
+    v4fpmul1271_unreduced(a[0], b[0], t00);
+    v4fpmul1271_unreduced(a[1], b[1], t11);
+    v4fpmul1271_unreduced(a[0], b[1], t01);
+    v4fpmul1271_unreduced(a[1], b[0], t10);
+    v4fpcarry1271(t00);
+    v4fpcarry1271(t11);
+    for (i = 0; i < 5; i++) {
+        c[1][i] = _mm256_add_epi64(t01[i], t10[i]);
+    }
+    v4fpsub1271(t00, t11, c[0]);
+    v4fpcarry1271(c[0]);
+    v4fpcarry1271(c[1]);
+}
+
+
+static __inline void v4fp2load1271(f2elm_t a0, f2elm_t a1, f2elm_t a2, f2elm_t a3, v4f2elm_t c)
+{ // Converts four GF(p^2) elements below 2^128 to radix 2^26, element k going to lane k
+    __m256i w0, w1;
+    unsigned int i;
+
+    for (i = 0; i < 2; i++) {
+        w0 = _mm256_set_epi64x((long long)a3[i][0], (long long)a2[i][0], (long long)a1[i][0], (long long)a0[i][0]);
+        w1 = _mm256_set_epi64x((long long)a3[i][1], (long long)a2[i][1], (long long)a1[i][1], (long long)a0[i][1]);
+        c[i][0] = _mm256_and_si256(w0, V4_MASK26);
+        c[i][1] = _mm256_and_si256(_mm256_srli_epi64(w0, 26), V4_MASK26);
+        c[i][2] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(w0, 52), _mm256_slli_epi64(w1, 12)), V4_MASK26);
+        c[i][3] = _mm256_and_si256(_mm256_srli_epi64(w1, 14), V4_MASK26);
+        c[i][4] = _mm256_srli_epi64(w1, 40);
+    }
+}
+
+
+static void v4fp2store1271(v4f2elm_t a, f2elm_t c[4])
+{ // Converts the four lanes of a back to fully reduced GF(p^2) elements c[0..3]
+    uint64_t l[5][4], t[5];
+    unsigned int i, j, k, r;
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 5; j++) {
+            _mm256_storeu_si256((__m256i*)l[j], a[i][j]);
+        }
+        for (k = 0; k < 4; k++) {
+            for (j = 0; j < 5; j++) {
+                t[j] = l[j][k];
+            }
+            for (r = 0; r < 2; r++) {                      // Two rounds of carry propagation and folding at 2^127 = 1 (mod p)
+                for (j = 0; j < 4; j++) {
+                    t[j+1] += t[j] >> 26;
+                    t[j] &= 0x3FFFFFF;
+                }
+                t[0] += t[4] >> 23;
+                t[4] &= 0x7FFFFF;
+            }
+            c[k][i][0] = t[0] | (t[1] << 26) | (t[2] << 52);
+            c[k][i][1] = (t[2] >> 12) | (t[3] << 14) | (t[4] << 40);
+            mod1271(c[k][i]);
+        }
+    }
+}
+
+
+static __inline void v4eccmadd(v4point_precomp *Q, v4point_extproj *P)
+{ // Four-way mixed point addition P = P+Q, lane by lane, following the same formulas as eccmadd
+    v4f2elm_t t1, t2;
+
+    v4fp2mul1271(P->ta, P->tb, P->ta);          // Ta = T1
+    v4fp2add1271(P->z, P->z, t1);               // t1 = 2Z1
+    v4fp2mul1271(P->ta, Q->t2, P->ta);          // Ta = 2dT1*t2
+    v4fp2add1271(P->x, P->y, P->z);             // Z = (X1+Y1)
+    v4fp2sub1271(P->y, P->x, P->tb);            // Tb = (Y1-X1)
+    v4fp2sub1271(t1, P->ta, t2);                // t2 = theta
+    v4fp2add1271(t1, P->ta, t1);                // t1 = alpha
+    v4fp2mul1271(Q->xy, P->z, P->ta);           // Ta = (X1+Y1)(x2+y2)
+    v4fp2mul1271(Q->yx, P->tb, P->x);           // X = (Y1-X1)(y2-x2)
+    v4fp2mul1271(t1, t2, P->z);                 // Zfinal = theta*alpha
+    v4fp2sub1271(P->ta, P->x, P->tb);           // Tbfinal = beta
+    v4fp2add1271(P->ta, P->x, P->ta);           // Tafinal = omega
+    v4fp2mul1271(P->tb, t2, P->x);              // Xfinal = beta*theta
+    v4fp2mul1271(P->ta, t1, P->y);              // Yfinal = alpha*omega
+}
+
+
+void eccmadd_sum_x4(point_precomp **Q[4], unsigned int n, point_extproj_t R[4])
+{ // Four independent sums of precomputed points, R[k] = Q[k][0]+...+Q[k][n-1] for k = 0..3, with n > 0.
+  // The four accumulations advance together, one per 64-bit lane of the AVX2 registers.
+  // Output: R[k] = (X,Y,Z,Ta,Tb) with fully reduced coordinates.
+    v4point_extproj P;
+    v4point_precomp V;
+    f2elm_t c[4];
+    unsigned int i, j, k;
+
+    for (j = 0; j < 5; j++) {                                     // P = neutral point (0,1,1,0,1) in every lane
+        for (k = 0; k < 2; k++) {
+            P.x[k][j] = P.ta[k][j] = _mm256_setzero_si256();
+            P.y[k][j] = P.z[k][j] = P.tb[k][j] = _mm256_set1_epi64x((j == 0 && k == 0) ? 1 : 0);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        v4fp2load1271(Q[0][i]->xy, Q[1][i]->xy, Q[2][i]->xy, Q[3][i]->xy, V.xy);
+        v4fp2load1271(Q[0][i]->yx, Q[1][i]->yx, Q[2][i]->yx, Q[3][i]->yx, V.yx);
+        v4fp2load1271(Q[0][i]->t2, Q[1][i]->t2, Q[2][i]->t2, Q[3][i]->t2, V.t2);
+        v4eccmadd(&V, &P);
+    }
+
+    v4fp2store1271(P.x, c);  for (k = 0; k < 4; k++) fp2copy1271(c[k], R[k]->x);
+    v4fp2store1271(P.y, c);  for (k = 0; k < 4; k++) fp2copy1271(c[k], R[k]->y);
+    v4fp2store1271(P.z, c);  for (k = 0; k < 4; k++) fp2copy1271(c[k], R[k]->z);
+    v4fp2store1271(P.ta, c); for (k = 0; k < 4; k++) fp2copy1271(c[k], R[k]->ta);
+    v4fp2store1271(P.tb, c); for (k = 0; k < 4; k++) fp2copy1271(c[k], R[k]->tb);
+}
+
+#else
+
+void eccmadd_sum_x4(point_precomp **Q[4], unsigned int n, point_extproj_t R[4])
+{ // Four independent sums of precomputed points, R[k] = Q[k][0]+...+Q[k][n-1] for k = 0..3, with n > 0.
+  // Portable version: the four sums advance in lock-step in scalar registers.
+
+    eccmadd_sum_interleaved(Q, 4, n, R);
+}
+
+#endif
+
+
 bool ecc_mul_fixed(digit_t* k, point_t Q)
 { // Fixed-base scalar multiplication Q = k*G, where G is the generator. FIXED_BASE_TABLE stores v*2^(w-1) = 80 multiples of G.
   // Inputs: scalar "k" in [0, 2^256-1].
@@ -527,6 +931,22 @@ bool ecc_mul_double(digit_t* k, point_t Q, digit_t* l, point_t R)
   //         scalars "k" and "l" in [0, 2^256-1].
   // Output: R = k*G + l*Q in affine coordinates (x,y).
   // The function uses wNAF with interleaving.
+    point_extproj_t T;
+
+    if (ecc_mul_double_extproj(k, Q, l, T) == false) {
+        return false;
+    }
+    eccnorm(T, R);                                             // Output R = (x,y)
+    
+    return true;
+}
+
+
+bool ecc_mul_double_extproj(digit_t* k, point_t Q, digit_t* l, point_extproj_t T)
+{ // Double scalar multiplication T = k*G + l*Q without the final normalization, see ecc_mul_double().
+  // Inputs: point Q in affine coordinates,
+  //         scalars "k" and "l" in [0, 2^256-1].
+  // Output: T = k*G + l*Q in representation (X,Y,Z,Ta,Tb), e.g., for comparison with ecc_equal_extproj().
             
     // SECURITY NOTE: this function is intended for a non-constant-time operation such as signature verification. 
 
@@ -535,7 +955,7 @@ bool ecc_mul_double(digit_t* k, point_t Q, digit_t* l, point_t R)
     int i, digits_k1[65] = {0}, digits_k2[65] = {0}, digits_k3[65] = {0}, digits_k4[65] = {0};
     int digits_l1[65] = {0}, digits_l2[65] = {0}, digits_l3[65] = {0}, digits_l4[65] = {0};
 	point_precomp_t V;
-    point_extproj_t Q1, Q2, Q3, Q4, T; 
+    point_extproj_t Q1, Q2, Q3, Q4; 
     point_extproj_precomp_t U, Q_table1[NPOINTS_DOUBLEMUL_WQ], Q_table2[NPOINTS_DOUBLEMUL_WQ], Q_table3[NPOINTS_DOUBLEMUL_WQ], Q_table4[NPOINTS_DOUBLEMUL_WQ];
     uint64_t k_scalars[4], l_scalars[4];
     
@@ -644,7 +1064,6 @@ bool ecc_mul_double(digit_t* k, point_t Q, digit_t* l, point_t R)
 
 #else
     point_t A;
-    point_extproj_t T;
     point_extproj_precomp_t S;
 
     if (ecc_mul(Q, l, A, false) == false) {
@@ -657,12 +1076,54 @@ bool ecc_mul_double(digit_t* k, point_t Q, digit_t* l, point_t R)
     point_setup(A, T);
     eccadd(S, T);
 #endif
-    eccnorm(T, R);                                             // Output R = (x,y)
     
     return true;
 }
 
 
+static bool fp2equal1271(f2elm_t a, f2elm_t b)
+{ // Comparison of two GF(p^2) elements, which are fully reduced in place. Non constant-time
+    unsigned int i;
+
+    mod1271(a[0]); mod1271(a[1]);
+    mod1271(b[0]); mod1271(b[1]);
+    for (i = 0; i < NWORDS_FIELD; i++) {
+        if (a[0][i] != b[0][i] || a[1][i] != b[1][i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool ecc_equal_extproj(point_extproj_t P, point_extproj_t Q)
+{ // Equality test of two points in representation (X,Y,Z,Ta,Tb) without inversion: X1*Z2 = X2*Z1 and Y1*Z2 = Y2*Z1.
+  // Returns false if Z1 or Z2 is zero, so that degenerate inputs (e.g., from a malicious party) never compare equal.
+  // SECURITY NOTE: this function does not run in constant time.
+    f2elm_t t1, t2;
+
+    fp2zero1271(t2);
+    fp2copy1271(P->z, t1);
+    if (fp2equal1271(t1, t2) == true) {
+        return false;
+    }
+    fp2copy1271(Q->z, t1);
+    if (fp2equal1271(t1, t2) == true) {
+        return false;
+    }
+
+    fp2mul1271(P->x, Q->z, t1);             // X1*Z2
+    fp2mul1271(Q->x, P->z, t2);             // X2*Z1
+    if (fp2equal1271(t1, t2) == false) {
+        return false;
+    }
+    fp2mul1271(P->y, Q->z, t1);             // Y1*Z2
+    fp2mul1271(Q->y, P->z, t2);             // Y2*Z1
+
+    return fp2equal1271(t1, t2);
+}
+
+
 void ecc_precomp_double(point_extproj_t P, point_extproj_precomp_t* Table, unsigned int npoints)
 { // Generation of the precomputation table used internally by the double scalar multiplication function ecc_mul_double().  
   // Inputs: point P in representation (X,Y,Z,Ta,Tb),
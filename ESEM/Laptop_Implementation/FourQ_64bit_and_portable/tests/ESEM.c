@@ -6,34 +6,15 @@
 * Abstract: testing code for cryptographic functions based on FourQ 
 ************************************************************************************/   
 
-#include "../FourQ_api.h"
-#include "../FourQ_params.h"
+#include "ESEM.h"
  
 #include "test_extras.h"
 #include <stdio.h>
 #include "aes.h"
 #include "blake2.h"
 #include "zmq.h"
-
-#define HIGH_SPEED 1
-
-#define CMD_REQUEST_VERIFICATION         0x000010
-
-// Benchmark and test parameters 
-
-//For easy testing, no random keys are used in this implementation. secret_key, public_key should be generated new every time.
-
-#if defined(HIGH_SPEED) // This is ESEMv2
-    #define BENCH_LOOPS       100000      // Number of iterations per bench
-    #define BPV_V             40
-    #define ESEM_L            3
-    #define BPV_N             128
-#else 
-    #define BENCH_LOOPS       100000
-    #define BPV_V             18
-    #define ESEM_L            3
-    #define BPV_N             1024
-#endif
+#include <signal.h>
+#include <unistd.h>
 
 void print_hex(unsigned char* arr, int len)
 {
@@ -53,7 +34,10 @@ void menu(){
     printf("(2) Signer\n");
     printf("(3) Server\n");
     printf("(4) Verifier\n");
-    printf("(5) Exit\n\n\n");
+    printf("(5) Exit\n");
+    printf("(6) Long-running Server\n");
+    printf("(7) Commitment Benchmark\n");
+    printf("(8) Provision Device Store\n\n\n");
 
 }
 
@@ -383,147 +367,432 @@ ECCRYPTO_STATUS ESEM_Sign_v2(unsigned char secret_key[32], unsigned char *messag
 }
 
 
-ECCRYPTO_STATUS ESEM_Server(unsigned char *publicAll_1, unsigned char *publicAll_2, unsigned char *publicAll_3, unsigned char tempKey1[32], unsigned char tempKey2[32], unsigned char tempKey3[32]){
-
-    ECCRYPTO_STATUS Status = ECCRYPTO_SUCCESS;
-
-    unsigned char randValue[16];
-    unsigned char hashOutput[36] = {0};
-    uint64_t i, index2;
-    unsigned char lastPublic1[64];
-    unsigned char lastPublic2[64];
-    unsigned char lastPublic3[64];
-    unsigned char publicTemp[64];   
-    point_extproj_t TempExtproj1, TempExtproj2, TempExtproj3;
-    point_extproj_precomp_t TempExtprojPre1, TempExtprojPre2, TempExtprojPre3;
-    point_extproj_t RVerify1, RVerify2, RVerify3;
-
-    void *context = zmq_ctx_new ();
-    void *responder = zmq_socket (context, ZMQ_REP);
-    int rc = zmq_bind (responder, "tcp://*:5555");
-
-    zmq_recv (responder, randValue, 16, 0);
-    print_hex(randValue, 16);
-
-
-    blake2b(hashOutput, randValue, tempKey1, 36, 16, 32);
-
-    index2 = hashOutput[0] + ((hashOutput[1]/64) * 256);
-    
-    memmove(publicTemp,publicAll_1 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, RVerify1);
-
-    index2 = hashOutput[2] + ((hashOutput[3]/64) * 256);
-
-    memmove(publicTemp,publicAll_1 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, TempExtproj1);
+void ESEM_Precompute(unsigned char *publicAll, point_precomp_t *publicTable){ // Converts the BPV public values Y[i] to (x+y,y-x,2dt) once, so the server only performs mixed additions
 
-    R1_to_R2(TempExtproj1, TempExtprojPre1);
-    eccadd(TempExtprojPre1, RVerify1);
+    uint64_t i;
 
+    for (i = 0; i < BPV_N; i++){
+        point_setup_precomp((point_affine*)(publicAll + 64*i), publicTable[i]);
+    }
 
-    for (i = 2; i < BPV_V; ++i) { // Same as above happens in the loop
-        index2 = hashOutput[2*i] + ((hashOutput[2*i+1]/64) * 256);
+}
 
-        memmove(publicTemp,publicAll_1 +64*index2,64);
-        point_setup((point_affine*)publicTemp, TempExtproj1);
 
-        R1_to_R2(TempExtproj1, TempExtprojPre1);
-        eccadd(TempExtprojPre1, RVerify1);   // Add the R[i]'s and compute the final R
+void ESEM_Bench_Commit(point_precomp_t *publicTable, unsigned char tempKey[32]){ // Additions, cycles and table bytes per party of the subset-sum tables, of four-way aggregation and of the ESEM_L parties of a request sequentially and in lock-step, against the plain table of ESEM_Server_v2, and the cost of each response format
+
+    unsigned int block, nadd, k, format, frameLen = 0;
+    uint64_t benchLoop, additions;
+    int64_t cycles, cycles1, cycles2;
+    unsigned char frame[ESEM_MAX_FRAME_BYTES];
+    size_t tableBytes;
+    bool match;
+    unsigned char randValue[16] = {0};
+    point_precomp_t *subsetTable = NULL;
+    unsigned char randValues[4][16] = {{0}}, *randValue4[4], *tempKey4[4];
+    point_precomp_t *publicTable4[4];
+    point_extproj_t R, RPlain, R4[4];
+    point_t A, APlain;
+
+    printf("Block  Table bytes  Additions/commitment  Cycles/commitment\n");
+    for (block = 0; block <= ESEM_SUBSET_MAX_BLOCK; block++) {
+        if (block != 0) {
+            subsetTable = ESEM_Precompute_Subsets(publicTable, block);
+            if (subsetTable == NULL) {
+                printf("Problem Occurred in Precompute\n");
+                return;
+            }
+        }
+        additions = 0;
+        cycles = 0;
+        match = true;
+        for (benchLoop = 0; benchLoop < BENCH_LOOPS; benchLoop++) {
+            memcpy(randValue, &benchLoop, sizeof(benchLoop));
+            cycles1 = cpucycles();
+            if (block == 0) {
+                ESEM_Commit(publicTable, tempKey, randValue, R);
+                nadd = BPV_V - 1;
+            } else {
+                nadd = ESEM_Commit_Subsets(subsetTable, block, tempKey, randValue, R);
+            }
+            cycles += cpucycles() - cycles1;
+            additions += nadd;
+
+            if (block != 0 && benchLoop < 100) { // Spot-check against the plain table
+                ESEM_Commit(publicTable, tempKey, randValue, RPlain);
+                eccnorm(R, A);
+                eccnorm(RPlain, APlain);
+                match = match && (memcmp(A, APlain, sizeof(point_t)) == 0);
+            }
+        }
+        tableBytes = (block == 0) ? BPV_N*sizeof(point_precomp_t) : ((BPV_N + block - 1)/block)*((1 << block) - 1)*sizeof(point_precomp_t);
+        printf("%5u  %11zu  %20.2f  %17.0f%s\n", block, tableBytes, (double)additions/BENCH_LOOPS, (double)cycles/BENCH_LOOPS, match ? "" : "  MISMATCH");
+        ESEM_Table_Free(subsetTable);
+        subsetTable = NULL;
     }
 
-    eccnorm(RVerify1, (point_affine*)lastPublic1);
-
-    zmq_send(responder, lastPublic1, 64, 0);
+    cycles = 0;
+    match = true;
+    for (k = 0; k < 4; k++) {
+        publicTable4[k] = publicTable;
+        tempKey4[k] = tempKey;
+        randValue4[k] = randValues[k];
+    }
+    for (benchLoop = 0; benchLoop < BENCH_LOOPS; benchLoop += 4) {
+        for (k = 0; k < 4; k++) {
+            uint64_t x = benchLoop + k;
+            memcpy(randValues[k], &x, sizeof(x));
+        }
+        cycles1 = cpucycles();
+        ESEM_Commit_x4(publicTable4, tempKey4, randValue4, R4);
+        cycles += cpucycles() - cycles1;
+
+        if (benchLoop < 100) { // Spot-check against the plain table
+            for (k = 0; k < 4; k++) {
+                ESEM_Commit(publicTable, tempKey, randValues[k], RPlain);
+                eccnorm(R4[k], A);
+                eccnorm(RPlain, APlain);
+                match = match && (memcmp(A, APlain, sizeof(point_t)) == 0);
+            }
+        }
+    }
+    printf("%5s  %11zu  %20.2f  %17.0f%s\n", "x4", BPV_N*sizeof(point_precomp_t), (double)BPV_V, (double)cycles/BENCH_LOOPS, match ? "" : "  MISMATCH");
+
+    cycles = 0;                                  // The ESEM_L parties of one request, one after the other
+    cycles2 = 0;                                 // and in lock-step
+    match = true;
+    for (k = 0; k < ESEM_L; k++) {
+        publicTable4[k] = publicTable;
+        tempKey4[k] = tempKey;
+        randValue4[k] = randValues[0];
+    }
+    for (benchLoop = 0; benchLoop < BENCH_LOOPS; benchLoop += ESEM_L) {
+        memcpy(randValues[0], &benchLoop, sizeof(benchLoop));
+        cycles1 = cpucycles();
+        for (k = 0; k < ESEM_L; k++) {
+            ESEM_Commit(publicTable4[k], tempKey4[k], randValue4[k], R4[k]);
+        }
+        cycles += cpucycles() - cycles1;
+        cycles1 = cpucycles();
+        ESEM_Commit_Interleaved(publicTable4, tempKey4, randValue4, ESEM_L, R4);
+        cycles2 += cpucycles() - cycles1;
+
+        if (benchLoop < 100) {
+            ESEM_Commit(publicTable, tempKey, randValues[0], RPlain);
+            for (k = 0; k < ESEM_L; k++) {
+                match = match && ecc_equal_extproj(R4[k], RPlain);
+            }
+        }
+    }
+    printf("%5s  %11zu  %20.2f  %17.0f\n", "L seq", BPV_N*sizeof(point_precomp_t), (double)BPV_V, (double)cycles/BENCH_LOOPS);
+    printf("%5s  %11zu  %20.2f  %17.0f%s\n", "L ilv", BPV_N*sizeof(point_precomp_t), (double)BPV_V, (double)cycles2/BENCH_LOOPS, match ? "" : "  MISMATCH");
+
+    printf("\nFormat      Bytes/reply  Server cycles/commitment  Verifier cycles/commitment\n");
+    for (format = 0; format < 3; format++) { // Affine (unbatched normalization), projective and compressed responses
+        cycles = 0;
+        cycles2 = 0;
+        match = true;
+        for (benchLoop = 0; benchLoop < BENCH_LOOPS/100; benchLoop++) {
+            memcpy(randValue, &benchLoop, sizeof(benchLoop));
+            ESEM_Commit(publicTable, tempKey, randValue, R);
+            cycles1 = cpucycles();
+            if (format == 1) {
+                ESEM_Encode_Projective(R, frame);
+                frameLen = ESEM_PROJ_BYTES;
+            } else {
+                eccnorm(R, (point_affine*)frame);
+                frameLen = ESEM_POINT_BYTES;
+                if (format == 2) {
+                    ESEM_Encode_Compressed(frame);
+                    frameLen = ESEM_COMPRESSED_BYTES;
+                }
+            }
+            cycles += cpucycles() - cycles1;
+            cycles1 = cpucycles();
+            match = ESEM_Decode_Commitment(frame, frameLen, RPlain) && match;
+            cycles2 += cpucycles() - cycles1;
 
-    zmq_recv (responder, randValue, 16, 0);
-    print_hex(randValue, 16);
+            ESEM_Commit(publicTable, tempKey, randValue, R);
+            match = match && ecc_equal_extproj(R, RPlain);
+        }
+        printf("%-10s  %11u  %24.0f  %26.0f%s\n", (format == 0) ? "affine" : (format == 1) ? "projective" : "compressed", ESEM_L*frameLen,
+               (double)cycles/(BENCH_LOOPS/100), (double)cycles2/(BENCH_LOOPS/100), match ? "" : "  MISMATCH");
+    }
 
+}
 
 
-    blake2b(hashOutput, randValue, tempKey2, 36, 16, 32);
+void ESEM_Bench_Pages(point_precomp_t *publicTable){ // Cycles and data TLB misses per commitment over ESEM_L tables of BPV_N = 128, 1024 and 65536 entries on each page size. The larger tables are tiled from the 128-entry one, since only the memory access pattern matters here
+
+    static const unsigned int sizes[3] = {128, 1024, 65536};
+    static const char *pageNames[3] = {"small", "transparent", "hugetlb"};
+    unsigned int size, pages, obtained, l, j, index;
+    uint64_t benchLoop, x = 0x9E3779B97F4A7C15ULL;
+    int64_t cycles, cycles1, misses;
+    size_t tableBytes, e;
+    int tlb;
+    point_precomp_t *table[ESEM_L];
+    point_extproj_t R;
+
+    printf("\nEntries  Pages        Obtained     Table bytes  Cycles/commitment  dTLB misses/commitment\n");
+    for (size = 0; size < 3; size++) {
+        tableBytes = (size_t)sizes[size]*sizeof(point_precomp_t);
+        for (pages = ESEM_PAGES_SMALL; pages <= ESEM_PAGES_HUGETLB; pages++) {
+            for (l = 0; l < ESEM_L; l++) {
+                table[l] = ESEM_Table_Alloc_Pages(tableBytes, pages);
+                if (table[l] == NULL) {
+                    printf("Problem Occurred in Table Allocation\n");
+                    while (l-- > 0) ESEM_Table_Free(table[l]);
+                    return;
+                }
+                for (e = 0; e < sizes[size]; e++) {
+                    memcpy(table[l][e], publicTable[e % BPV_N], sizeof(point_precomp_t));
+                }
+            }
+            obtained = ESEM_Table_Pages(table[0]);
+
+            tlb = ESEM_Tlb_Open();
+            cycles1 = cpucycles();
+            for (benchLoop = 0; benchLoop < BENCH_LOOPS/10; benchLoop++) {
+                for (l = 0; l < ESEM_L; l++) { // Uniform indices, as produced by the hash in ESEM_Commit
+                    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                    R5_to_R1(table[l][x % sizes[size]], R);
+                    for (j = 1; j < BPV_V; j++) {
+                        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+                        index = (unsigned int)(x % sizes[size]);
+                        eccmadd_ni(table[l][index], R);
+                    }
+                }
+            }
+            cycles = cpucycles() - cycles1;
+            misses = ESEM_Tlb_Close(tlb);
+
+            printf("%7u  %-11s  %-11s  %11zu  %17.0f  ", sizes[size], pageNames[pages], pageNames[obtained], ESEM_L*tableBytes, (double)cycles/(BENCH_LOOPS/10));
+            if (misses < 0) {
+                printf("%22s\n", "n/a");
+            } else {
+                printf("%22.2f\n", (double)misses/(BENCH_LOOPS/10));
+            }
+            for (l = 0; l < ESEM_L; l++) {
+                ESEM_Table_Free(table[l]);
+            }
+        }
+    }
+    printf("(transparent: the kernel may still have used small pages, see AnonHugePages in /proc/meminfo)\n");
+}
 
-    index2 = hashOutput[0] + ((hashOutput[1]/64) * 256);
-    
-    memmove(publicTemp,publicAll_2 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, RVerify2);
 
-    index2 = hashOutput[2] + ((hashOutput[3]/64) * 256);
+void ESEM_Bench_Party(point_precomp_t *publicTable, unsigned char tempKey[32]){ // Latency of the ESEM_L partial commitments of one request computed by one thread, and spread over it and ESEM_PARTY_THREADS threads of a party pool
 
-    memmove(publicTemp,publicAll_2 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, TempExtproj2);
+    esem_party_pool_t *pool;
+    esem_party_job_t jobs[ESEM_L];
+    point_extproj_t R[ESEM_L], RPlain;
+    unsigned char randValue[16] = {0};
+    unsigned int j, remaining = 0;
+    uint64_t benchLoop;
+    long serial = 0, parallel = 0, start;
+    bool match = true;
 
-    R1_to_R2(TempExtproj2, TempExtprojPre2);
-    eccadd(TempExtprojPre2, RVerify2);
+    pool = ESEM_Party_New(ESEM_PARTY_THREADS);
+    if (pool == NULL) {
+        printf("\nNo party pool (ESEM_PARTY_THREADS is 0)\n");
+        return;
+    }
+    for (j = 0; j < ESEM_L; j++) {
+        jobs[j].table = publicTable;
+        jobs[j].block = 0;
+        jobs[j].tempKey = tempKey;
+        jobs[j].randValue = randValue;
+        jobs[j].R = R[j];
+        jobs[j].remaining = &remaining;
+    }
+    for (benchLoop = 0; benchLoop < BENCH_LOOPS/100; benchLoop++) {
+        memcpy(randValue, &benchLoop, sizeof(benchLoop));
+        start = ESEM_Now_us();
+        for (j = 0; j < ESEM_L; j++) {
+            ESEM_Commit(publicTable, tempKey, randValue, R[j]);
+        }
+        serial += ESEM_Now_us() - start;
 
+        start = ESEM_Now_us();
+        ESEM_Party_Post(pool, jobs, ESEM_L);
+        ESEM_Party_Wait(pool, &remaining);
+        parallel += ESEM_Now_us() - start;
 
-    for (i = 2; i < BPV_V; ++i) { // Same as above happens in the loop
-        index2 = hashOutput[2*i] + ((hashOutput[2*i+1]/64) * 256);
+        ESEM_Commit(publicTable, tempKey, randValue, RPlain);
+        for (j = 0; j < ESEM_L; j++) {
+            match = match && ecc_equal_extproj(R[j], RPlain);
+        }
+    }
+    ESEM_Party_Free(pool);
+    printf("\nParties of a request  One thread: %.1f us  %u threads: %.1f us%s\n", (double)serial/(BENCH_LOOPS/100),
+           ESEM_PARTY_THREADS + 1, (double)parallel/(BENCH_LOOPS/100), match ? "" : "  MISMATCH");
+}
 
-        memmove(publicTemp,publicAll_2 +64*index2,64);
-        point_setup((point_affine*)publicTemp, TempExtproj2);
 
-        R1_to_R2(TempExtproj2, TempExtprojPre2);
-        eccadd(TempExtprojPre2,RVerify2);   // Add the R[i]'s and compute the final R
+void ESEM_Bench_Affine(point_precomp_t *publicTable, unsigned char tempKey[32]){ // Cycles per commitment of many concurrent commitments summed in projective coordinates and normalized by eccnorm_batch, against ecc_sum_affine_batch
+
+    static const unsigned int sizes[4] = {1, 16, 256, 4096};
+    unsigned int size, count, k, rounds, r;
+    int64_t cycles, cycles2, cycles1;
+    point_precomp_t **table;
+    unsigned char **key, **randValue, *values;
+    point_extproj_t *R;
+    point_t *A, *B;
+    bool match = true;
+
+    count = sizes[3];
+    table = malloc(count*sizeof(point_precomp_t*));
+    key = malloc(count*sizeof(unsigned char*));
+    randValue = malloc(count*sizeof(unsigned char*));
+    values = malloc((size_t)count*16);
+    R = malloc(count*sizeof(point_extproj_t));
+    A = malloc(count*sizeof(point_t));
+    B = malloc(count*sizeof(point_t));
+    if (table == NULL || key == NULL || randValue == NULL || values == NULL || R == NULL || A == NULL || B == NULL) {
+        printf("Problem Occurred in Allocation\n");
+        goto cleanup;
+    }
+    for (k = 0; k < count; k++) {
+        table[k] = publicTable;
+        key[k] = tempKey;
+        randValue[k] = values + 16*k;
     }
 
-    eccnorm(RVerify2, (point_affine*)lastPublic2);
-
-    zmq_send(responder, lastPublic2, 64, 0);
+    printf("\nSums  Projective+eccnorm_batch cycles/commitment  Affine batch cycles/commitment\n");
+    for (size = 0; size < 4; size++) {
+        count = sizes[size];
+        rounds = (BENCH_LOOPS/100 + count - 1)/count;
+        cycles = 0;
+        cycles2 = 0;
+        for (r = 0; r < rounds; r++) {
+            for (k = 0; k < count; k++) {
+                uint64_t x = (uint64_t)r*count + k;
+                memset(randValue[k], 0, 16);
+                memcpy(randValue[k], &x, sizeof(x));
+            }
+            cycles1 = cpucycles();
+            for (k = 0; k < count; k++) {
+                ESEM_Commit(table[k], key[k], randValue[k], R[k]);
+            }
+            eccnorm_batch(R, A, count);
+            cycles += cpucycles() - cycles1;
 
-    zmq_recv (responder, randValue, 16, 0);
-    print_hex(randValue, 16);
+            cycles1 = cpucycles();
+            if (ESEM_Commit_Affine_Batch(table, key, randValue, count, B) != ECCRYPTO_SUCCESS) {
+                printf("Problem Occurred in Allocation\n");
+                goto cleanup;
+            }
+            cycles2 += cpucycles() - cycles1;
+            match = match && (memcmp(A, B, count*sizeof(point_t)) == 0);
+        }
+        printf("%4u  %43.0f  %30.0f%s\n", count, (double)cycles/(rounds*count), (double)cycles2/(rounds*count), match ? "" : "  MISMATCH");
+    }
 
+cleanup:
+    free(table);
+    free(key);
+    free(randValue);
+    free(values);
+    free(R);
+    free(A);
+    free(B);
+}
 
-    blake2b(hashOutput, randValue, tempKey3, 36, 16, 32);
 
-    index2 = hashOutput[0] + ((hashOutput[1]/64) * 256);
-    
-    memmove(publicTemp,publicAll_3 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, RVerify3);
+static void *ESEM_Bench_Responder(void *arg){ // Answers every request with ESEM_L compressed commitments, the reply of ESEM_Server_v2 to the verifier, until a one-byte request. Closes the transport, which sends the last reply
 
-    index2 = hashOutput[2] + ((hashOutput[3]/64) * 256);
+    esem_transport_t *responder = (esem_transport_t*)arg;
+    unsigned char request[ESEM_REQUEST_BYTES], reply[ESEM_COMPRESSED_BYTES] = {0};
+    unsigned int j;
+    bool more;
+    int rc;
 
-    memmove(publicTemp,publicAll_3 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, TempExtproj3);
+    do {
+        rc = ESEM_Transport_Recv(responder, request, ESEM_REQUEST_BYTES, &more);
+        for (j = 0; j < ESEM_L; j++) {
+            ESEM_Transport_Send(responder, reply, ESEM_COMPRESSED_BYTES, j+1 < ESEM_L);
+        }
+    } while (rc > 1);
+    ESEM_Transport_Close(responder);
+    return NULL;
 
-    R1_to_R2(TempExtproj3, TempExtprojPre3);
-    eccadd(TempExtprojPre3, RVerify3);
+}
 
 
-    for (i = 2; i < BPV_V; ++i) { // Same as above happens in the loop
-        index2 = hashOutput[2*i] + ((hashOutput[2*i+1]/64) * 256);
+static int ESEM_Compare_Long(const void *a, const void *b){
 
-        memmove(publicTemp,publicAll_3 +64*index2,64);
-        point_setup((point_affine*)publicTemp, TempExtproj3);
+    return (*(const long*)a > *(const long*)b) - (*(const long*)a < *(const long*)b);
 
-        R1_to_R2(TempExtproj3, TempExtprojPre3);
-        eccadd(TempExtprojPre3,RVerify3);   // Add the R[i]'s and compute the final R
-    }
+}
 
-    eccnorm(RVerify3, (point_affine*)lastPublic3);
 
-    zmq_send(responder, lastPublic3, 64, 0);
+void ESEM_Bench_Transport(void){ // Round-trip latency and requests/s of a verifier and a server on loopback over each transport, without computing commitments
 
+    esem_transport_t *responder, *requester;
+    unsigned char request[ESEM_REQUEST_BYTES] = {0}, frame[ESEM_MAX_FRAME_BYTES];
+    unsigned int kind, loops = BENCH_LOOPS/10, i, frames;
+    long *rtt, total;
+    struct timespec t0, t1;
+    pthread_t thread;
+    bool more;
 
-    return Status;
+    rtt = malloc(loops*sizeof(long));
+    if (rtt == NULL) {
+        return;
+    }
+    printf("\nTransport  Median round trip us  p99 us  Requests/s\n");
+    for (kind = 0; kind < ESEM_TRANSPORTS; kind++) {
+        responder = ESEM_Transport_Bind(kind, ESEM_BENCH_ENDPOINT);
+        if (responder == NULL) {
+            printf("%-9s  not available\n", ESEM_Transport_Name(kind));
+            continue;
+        }
+        requester = ESEM_Transport_Connect(kind, ESEM_BENCH_CONNECT_ENDPOINT);    // Queued in the listen backlog until accepted
+        if (requester == NULL || pthread_create(&thread, NULL, ESEM_Bench_Responder, responder) != 0) {
+            printf("%-9s  failed\n", ESEM_Transport_Name(kind));
+            ESEM_Transport_Close(requester);
+            ESEM_Transport_Close(responder);
+            continue;
+        }
+        for (i = 0, total = 0, frames = 0; i < loops; i++) {
+            memcpy(request, &i, sizeof(i));
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            ESEM_Transport_Send(requester, request, ESEM_REQUEST_BYTES, false);
+            do {
+                frames += ESEM_Transport_Recv(requester, frame, sizeof(frame), &more) == ESEM_COMPRESSED_BYTES;
+            } while (more);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            rtt[i] = (t1.tv_sec - t0.tv_sec)*1000000000L + (t1.tv_nsec - t0.tv_nsec);
+            total += rtt[i];
+        }
+        ESEM_Transport_Send(requester, request, 1, false);                    // Stops the responder
+        do {
+            ESEM_Transport_Recv(requester, frame, sizeof(frame), &more);
+        } while (more);
+        pthread_join(thread, NULL);
+        ESEM_Transport_Close(requester);
+        if (frames != loops*ESEM_L) {
+            printf("%-9s  failed\n", ESEM_Transport_Name(kind));
+            continue;
+        }
+        qsort(rtt, loops, sizeof(long), ESEM_Compare_Long);
+        printf("%-9s  %20.1f  %6.1f  %10.0f\n", ESEM_Transport_Name(kind), rtt[loops/2]/1000.0, rtt[loops - loops/100]/1000.0, loops*1e9/total);
+    }
+    free(rtt);
 
 }
 
 
-ECCRYPTO_STATUS ESEM_Server_v2(unsigned char *publicAll_1, unsigned char *publicAll_2, unsigned char *publicAll_3, unsigned char tempKey1[32], unsigned char tempKey2[32], unsigned char tempKey3[32]){
+ECCRYPTO_STATUS ESEM_Server(point_precomp_t *publicTable_1, point_precomp_t *publicTable_2, point_precomp_t *publicTable_3, unsigned char tempKey1[32], unsigned char tempKey2[32], unsigned char tempKey3[32]){
 
     ECCRYPTO_STATUS Status = ECCRYPTO_SUCCESS;
 
     unsigned char randValue[16];
-    unsigned char hashOutput[40] = {0};
+    unsigned char hashOutput[36] = {0};
     uint64_t i, index2;
     unsigned char lastPublic1[64];
     unsigned char lastPublic2[64];
     unsigned char lastPublic3[64];
-    unsigned char publicTemp[64];   
-    point_extproj_t TempExtproj1, TempExtproj2, TempExtproj3;
-    point_extproj_precomp_t TempExtprojPre1, TempExtprojPre2, TempExtprojPre3;
     point_extproj_t RVerify1, RVerify2, RVerify3;
 
     void *context = zmq_ctx_new ();
@@ -534,30 +803,14 @@ ECCRYPTO_STATUS ESEM_Server_v2(unsigned char *publicAll_1, unsigned char *public
     print_hex(randValue, 16);
 
 
-    blake2b(hashOutput, randValue, tempKey1, 40, 16, 32);
-
-    index2 = hashOutput[0]/2;
-    
-    memmove(publicTemp,publicAll_1 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, RVerify1);
-
-    index2 = hashOutput[1]/2;
-
-    memmove(publicTemp,publicAll_1 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, TempExtproj1);
-
-    R1_to_R2(TempExtproj1, TempExtprojPre1);
-    eccadd(TempExtprojPre1, RVerify1);
-
-
-    for (i = 2; i < BPV_V; ++i) { // Same as above happens in the loop
-        index2 = hashOutput[i]/2;
+    blake2b(hashOutput, randValue, tempKey1, 36, 16, 32);
 
-        memmove(publicTemp,publicAll_1 +64*index2,64);
-        point_setup((point_affine*)publicTemp, TempExtproj1);
+    index2 = hashOutput[0] + ((hashOutput[1]/64) * 256);
+    R5_to_R1(publicTable_1[index2], RVerify1);
 
-        R1_to_R2(TempExtproj1, TempExtprojPre1);
-        eccadd(TempExtprojPre1, RVerify1);   // Add the R[i]'s and compute the final R
+    for (i = 1; i < BPV_V; ++i) { 
+        index2 = hashOutput[2*i] + ((hashOutput[2*i+1]/64) * 256);
+        eccmadd_ni(publicTable_1[index2], RVerify1);   // Add the R[i]'s and compute the final R
     }
 
     eccnorm(RVerify1, (point_affine*)lastPublic1);
@@ -569,30 +822,14 @@ ECCRYPTO_STATUS ESEM_Server_v2(unsigned char *publicAll_1, unsigned char *public
 
 
 
-    blake2b(hashOutput, randValue, tempKey2, 40, 16, 32);
-
-    index2 = hashOutput[0]/2;
-    
-    memmove(publicTemp,publicAll_2 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, RVerify2);
-
-    index2 = hashOutput[1]/2;
-
-    memmove(publicTemp,publicAll_2 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, TempExtproj2);
-
-    R1_to_R2(TempExtproj2, TempExtprojPre2);
-    eccadd(TempExtprojPre2, RVerify2);
-
-
-    for (i = 2; i < BPV_V; ++i) { // Same as above happens in the loop
-        index2 = hashOutput[i]/2;
+    blake2b(hashOutput, randValue, tempKey2, 36, 16, 32);
 
-        memmove(publicTemp,publicAll_2 +64*index2,64);
-        point_setup((point_affine*)publicTemp, TempExtproj2);
+    index2 = hashOutput[0] + ((hashOutput[1]/64) * 256);
+    R5_to_R1(publicTable_2[index2], RVerify2);
 
-        R1_to_R2(TempExtproj2, TempExtprojPre2);
-        eccadd(TempExtprojPre2,RVerify2);   // Add the R[i]'s and compute the final R
+    for (i = 1; i < BPV_V; ++i) { 
+        index2 = hashOutput[2*i] + ((hashOutput[2*i+1]/64) * 256);
+        eccmadd_ni(publicTable_2[index2], RVerify2);   // Add the R[i]'s and compute the final R
     }
 
     eccnorm(RVerify2, (point_affine*)lastPublic2);
@@ -603,102 +840,231 @@ ECCRYPTO_STATUS ESEM_Server_v2(unsigned char *publicAll_1, unsigned char *public
     print_hex(randValue, 16);
 
 
-    blake2b(hashOutput, randValue, tempKey3, 40, 16, 32);
+    blake2b(hashOutput, randValue, tempKey3, 36, 16, 32);
 
-    index2 = hashOutput[0]/2;
-    
-    memmove(publicTemp,publicAll_3 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, RVerify3);
+    index2 = hashOutput[0] + ((hashOutput[1]/64) * 256);
+    R5_to_R1(publicTable_3[index2], RVerify3);
+
+    for (i = 1; i < BPV_V; ++i) { 
+        index2 = hashOutput[2*i] + ((hashOutput[2*i+1]/64) * 256);
+        eccmadd_ni(publicTable_3[index2], RVerify3);   // Add the R[i]'s and compute the final R
+    }
 
-    index2 = hashOutput[1]/2;
+    eccnorm(RVerify3, (point_affine*)lastPublic3);
 
-    memmove(publicTemp,publicAll_3 +64*index2, 64);
-    point_setup((point_affine*)publicTemp, TempExtproj3);
+    zmq_send(responder, lastPublic3, 64, 0);
 
-    R1_to_R2(TempExtproj3, TempExtprojPre3);
-    eccadd(TempExtprojPre3, RVerify3);
 
+    return Status;
 
-    for (i = 2; i < BPV_V; ++i) { // Same as above happens in the loop
-        index2 = hashOutput[i]/2;
+}
 
-        memmove(publicTemp,publicAll_3 +64*index2,64);
-        point_setup((point_affine*)publicTemp, TempExtproj3);
 
-        R1_to_R2(TempExtproj3, TempExtprojPre3);
-        eccadd(TempExtprojPre3,RVerify3);   // Add the R[i]'s and compute the final R
+ECCRYPTO_STATUS ESEM_Server_v2(point_precomp_t *publicTable_1, point_precomp_t *publicTable_2, point_precomp_t *publicTable_3, unsigned char tempKey1[32], unsigned char tempKey2[32], unsigned char tempKey3[32], unsigned int transport){
+
+    ECCRYPTO_STATUS Status = ECCRYPTO_SUCCESS;
+
+    unsigned char request[ESEM_MAX_REQUEST_BYTES];
+    point_precomp_t *publicTable[ESEM_L] = {publicTable_1, publicTable_2, publicTable_3};
+    unsigned char *tempKey[ESEM_L] = {tempKey1, tempKey2, tempKey3};
+    unsigned int j, n, mask, flags = 0, served = 0;
+    uint32_t device;
+    point_precomp_t *requestTable[ESEM_L];
+    unsigned char *requestKey[ESEM_L], *requestX[ESEM_L];
+    point_t lastPublic[ESEM_L];
+    point_extproj_t RVerify[ESEM_L];
+    unsigned char encoded[ESEM_PROJ_BYTES];
+    bool more;
+    int rc;
+
+    esem_transport_t *responder = ESEM_Transport_Bind(transport, ESEM_ENDPOINT);
+    if (responder == NULL) {
+        printf("Problem Occurred in binding %s over %s\n", ESEM_ENDPOINT, ESEM_Transport_Name(transport));
+        return ECCRYPTO_ERROR;
     }
 
-    eccnorm(RVerify3, (point_affine*)lastPublic3);
+    while (served != ESEM_PARTY_ALL) { // Until every party's commitment was sent, in one or several round trips
 
-    zmq_send(responder, lastPublic3, 64, 0);
+        rc = ESEM_Transport_Recv(responder, request, ESEM_MAX_REQUEST_BYTES, &more);
+        if (rc < ESEM_X_BYTES) {
+            Status = ECCRYPTO_ERROR;
+            break;
+        }
+        print_hex(request, 16);
+
+        if (rc == ESEM_X_BYTES) { // No party mask: the next party in order, in the legacy affine format
+            for (j = 0; served & (1 << j); j++);
+            mask = 1 << j;
+            flags = 0;
+        } else if (rc > ESEM_DEVICE_REQUEST_BYTES || ESEM_Device(request, rc, &device)) { // A batch, or the tables of a device,
+            mask = 0;                                                                   // which this server does not have
+        } else {
+            mask = ESEM_Parties(request, rc);
+            flags = ESEM_Flags(request, rc);
+        }
+
+        for (j = 0, n = 0; j < ESEM_L; j++) {
+            if (mask & (1 << j)) {
+                requestTable[n] = publicTable[j];
+                requestKey[n] = tempKey[j];
+                requestX[n++] = request;
+            }
+        }
+        if (n != 0) {
+            ESEM_Commit_Interleaved(requestTable, requestKey, requestX, n, RVerify);  // The parties' aggregations in lock-step
+        }
 
-    zmq_close (responder);
-    zmq_ctx_destroy (context);
+        if (n == 0) {
+            ESEM_Transport_Send(responder, NULL, 0, false);
+        }
+        if ((flags & ESEM_FLAGS) == ESEM_FLAG_PROJECTIVE) { // The verifier compares projectively, no inversion needed
+            for (j = 0; j < n; j++) {
+                ESEM_Encode_Projective(RVerify[j], encoded);
+                ESEM_Transport_Send(responder, encoded, ESEM_PROJ_BYTES, j+1 < n);
+            }
+        } else {
+            eccnorm_batch(RVerify, lastPublic, n);
+            for (j = 0; j < n; j++) {
+                if (flags & ESEM_FLAG_COMPRESSED) {
+                    encode(lastPublic[j], encoded);
+                    ESEM_Transport_Send(responder, encoded, ESEM_COMPRESSED_BYTES, j+1 < n);
+                } else {
+                    ESEM_Transport_Send(responder, lastPublic[j], 64, j+1 < n);
+                }
+            }
+        }
+        served |= mask;
+    }
+
+    ESEM_Transport_Close(responder);
 
     return Status;
 
 }
 
 
-ECCRYPTO_STATUS ESEM_Verifier(unsigned char *signature,  unsigned char *message, unsigned char public_key[64]){
+static unsigned int ESEM_Recv_Commitments(esem_transport_t *requester, point_extproj_t *R, unsigned int maxParts, unsigned int *frames, bool *busy){ // Receives a multipart reply of affine or projective commitments, returns the number decoded into R and sets frames to the number received
 
-    ECCRYPTO_STATUS Status = ECCRYPTO_SUCCESS;
+    unsigned int n = 0;
+    int rc;
+    bool more = true;
+    unsigned char frame[ESEM_MAX_FRAME_BYTES];
 
-    unsigned char public_value1[64];
-    unsigned char public_value2[64];
-    unsigned char public_value3[64];
-    unsigned char lastPublic[64];
-    unsigned char lastPublic_Verify[64];
+    *busy = false;
+    *frames = 0;
+    ESEM_TRACE_BEGIN(ESEM_EV_RECV, 0);
+    while (more) {
+        rc = ESEM_Transport_Recv(requester, frame, ESEM_MAX_FRAME_BYTES, &more);
+        if (rc == -1) {
+            break;
+        }
+        (*frames)++;
+        if (rc == 1 && frame[0] == ESEM_BUSY) {
+            *busy = true;
+        }
+        ESEM_TRACE_BEGIN(ESEM_EV_DECODE, rc);
+        if (n < maxParts && ESEM_Decode_Commitment(frame, rc, R[n])) {
+            n++;
+        }
+        ESEM_TRACE_END(ESEM_EV_DECODE, rc);
+    }
+    ESEM_TRACE_END(ESEM_EV_RECV, n);
 
+    return n;
 
-    point_extproj_t TempExtproj;
-    point_extproj_precomp_t TempExtprojPre;
-    point_extproj_t RVerify;
+}
 
 
-    void *context = zmq_ctx_new ();
-    void *requester = zmq_socket (context, ZMQ_REQ);
-    zmq_connect (requester, "tcp://localhost:5555");
+ECCRYPTO_STATUS ESEM_Verifier(unsigned char *signature,  unsigned char *message, unsigned char public_key[64], unsigned int transport){
+
+    ECCRYPTO_STATUS Status = ECCRYPTO_SUCCESS;
 
-    zmq_send (requester, signature, 16, 0);
-    zmq_recv (requester, public_value1, 64, 0);
+    unsigned char request[ESEM_REQUEST_BYTES];
+    unsigned int j, received, frames, attempt;
+    bool busy;
 
-    zmq_send (requester, signature, 16, 0);
-    zmq_recv (requester, public_value2, 64, 0);
 
-    zmq_send (requester, signature, 16, 0);
-    zmq_recv (requester, public_value3, 64, 0);
+    point_extproj_t Commitment[ESEM_L];
+    point_extproj_precomp_t TempExtprojPre;
+    point_extproj_t RVerify;
+    point_extproj_t RSign;
 
 
-    point_setup((point_affine*)public_value1, RVerify);
-    point_setup((point_affine*)public_value2, TempExtproj);
+    esem_transport_t *requester = ESEM_Transport_Connect(transport, ESEM_CONNECT_ENDPOINT);
+    if (requester == NULL) {
+        printf("Problem Occurred in connecting to %s over %s\n", ESEM_CONNECT_ENDPOINT, ESEM_Transport_Name(transport));
+        return ECCRYPTO_ERROR;
+    }
+
+    ESEM_TRACE_THREAD("verifier", -1);
+    memcpy(request, signature, ESEM_X_BYTES);    // x || party mask
+
+    request[ESEM_X_BYTES] = ESEM_PARTY_ALL | ESEM_VERIFIER_FLAGS;      // Ask for all partial commitments in one round trip
+    for (attempt = 0; ; attempt++) {
+        ESEM_TRACE_BEGIN(ESEM_EV_SEND, attempt);
+        ESEM_Transport_Send(requester, request, ESEM_REQUEST_BYTES, false);
+        ESEM_TRACE_END(ESEM_EV_SEND, attempt);
+        received = ESEM_Recv_Commitments(requester, Commitment, ESEM_L, &frames, &busy);
+        if (!busy || attempt == ESEM_BUSY_RETRIES) {
+            break;
+        }
+        usleep(ESEM_BUSY_BACKOFF_US << attempt);   // Back off while the server sheds load
+    }
+    if (busy) {
+        printf("Server busy, try again later\n");
+        Status = ECCRYPTO_ERROR;
+        goto cleanup;
+    }
+    if (received != frames || (frames != ESEM_L && frames != 1)) {    // A frame that does not decode leaves the parties of the
+        printf("Problem Occurred in receiving the commitments\n");     // next ones unknown
+        Status = ECCRYPTO_ERROR;
+        goto cleanup;
+    }
 
-    R1_to_R2(TempExtproj, TempExtprojPre);
-    eccadd(TempExtprojPre, RVerify);
+    for (j = received; j < ESEM_L; j++) {        // A server answering one party per round trip replied with the first one only
+        request[ESEM_X_BYTES] = (1 << j) | ESEM_VERIFIER_FLAGS;
+        ESEM_TRACE_BEGIN(ESEM_EV_SEND, 0);
+        ESEM_Transport_Send(requester, request, ESEM_REQUEST_BYTES, false);
+        ESEM_TRACE_END(ESEM_EV_SEND, 0);
+        if (ESEM_Recv_Commitments(requester, Commitment + j, 1, &frames, &busy) != 1 || frames != 1) {
+            printf("Problem Occurred in receiving the commitments\n");
+            Status = ECCRYPTO_ERROR;
+            goto cleanup;
+        }
+    }
 
-    point_setup((point_affine*)public_value3, TempExtproj);
 
-    R1_to_R2(TempExtproj, TempExtprojPre);
-    eccadd(TempExtprojPre, RVerify);   // Add the R[i]'s and compute the final R
+    ESEM_TRACE_BEGIN(ESEM_EV_AGGREGATE, ESEM_L);
+    ecccopy(Commitment[0], RVerify);
 
-    eccnorm(RVerify, (point_affine*)lastPublic);
+    for (j = 1; j < ESEM_L; j++) {
+        R1_to_R2(Commitment[j], TempExtprojPre);
+        eccadd(TempExtprojPre, RVerify);   // Add the R[i]'s and compute the final R, which stays in projective coordinates
+    }
+    ESEM_TRACE_END(ESEM_EV_AGGREGATE, ESEM_L);
 
+    ESEM_TRACE_BEGIN(ESEM_EV_VERIFY, 0);
     unsigned char hashedMsg[32] = {0}; 
     blake2b(hashedMsg, message, signature, 32, 32, 16);
 
     modulo_order((digit_t*)hashedMsg, (digit_t*)hashedMsg);
 
 
-    ecc_mul_double((digit_t*)(signature+16), (point_affine*)public_key, (digit_t*)hashedMsg, (point_affine*)lastPublic_Verify);
+    ecc_mul_double_extproj((digit_t*)(signature+16), (point_affine*)public_key, (digit_t*)hashedMsg, RSign);
 
-    if(memcmp(lastPublic, lastPublic_Verify, 64) == 0)
+    if(ecc_equal_extproj(RVerify, RSign))   // Cross-multiplication instead of normalizing both sides
         printf("Verified");
     else
         printf("Not Verified");
+    ESEM_TRACE_END(ESEM_EV_VERIFY, 0);
 
-    zmq_close (requester);
-    zmq_ctx_destroy (context);
+cleanup:
+    ESEM_Transport_Close(requester);
+#if ESEM_TRACE
+    if (!ESEM_Trace_Save(ESEM_TRACE_FILE)) {
+        printf("\nProblem Occurred in writing the trace %s\n", ESEM_TRACE_FILE);
+    }
+#endif
 
     return Status;
 
@@ -708,7 +1074,184 @@ ECCRYPTO_STATUS ESEM_Verifier(unsigned char *signature,  unsigned char *message,
 
 
 
-int main()
+ECCRYPTO_STATUS ESEM_Provision(const char *dir, unsigned int ndevices, unsigned int keyVersion, unsigned char sk_aes[32], unsigned char secret_key[32]){ // Writes ndevices simulated devices to the store in dir. Device d is generated from sk_aes xored with (d, keyVersion), so device 0 of version 0 is this one
+
+    ECCRYPTO_STATUS Status = ECCRYPTO_SUCCESS;
+    unsigned char deviceKey[32], deviceSecret[32], devicePublic[64], tempKey[ESEM_L][32];
+    unsigned char *publicAll[ESEM_L], *secretAll[ESEM_L], *keys[ESEM_L];
+    point_precomp_t *publicTable[ESEM_L];
+    unsigned int d, j;
+
+    for (j = 0; j < ESEM_L; j++) {
+        publicAll[j] = malloc(64*BPV_N);
+        secretAll[j] = malloc(32*BPV_N);
+        publicTable[j] = malloc(BPV_N*sizeof(point_precomp_t));
+        keys[j] = tempKey[j];
+    }
+    for (j = 0; j < ESEM_L; j++) {
+        if (publicAll[j] == NULL || secretAll[j] == NULL || publicTable[j] == NULL) {
+            Status = ECCRYPTO_ERROR_NO_MEMORY;
+            goto cleanup;
+        }
+    }
+
+    for (d = 0; d < ndevices; d++) {
+        memmove(deviceKey, sk_aes, 32);
+        memmove(deviceSecret, secret_key, 32);
+        deviceKey[0] ^= (unsigned char)d;
+        deviceKey[1] ^= (unsigned char)(d >> 8);
+        deviceKey[2] ^= (unsigned char)(d >> 16);
+        deviceKey[3] ^= (unsigned char)(d >> 24);
+        deviceKey[4] ^= (unsigned char)keyVersion;                     // Re-provisioning a device with a new version re-keys it
+        deviceKey[5] ^= (unsigned char)(keyVersion >> 8);
+        deviceKey[6] ^= (unsigned char)(keyVersion >> 16);
+        deviceKey[7] ^= (unsigned char)(keyVersion >> 24);
+        Status = ESEM_KeyGen(deviceKey, deviceSecret, devicePublic, publicAll[0], publicAll[1], publicAll[2], secretAll[0], secretAll[1], secretAll[2], tempKey[0], tempKey[1], tempKey[2]);
+        if (Status != ECCRYPTO_SUCCESS) {
+            goto cleanup;
+        }
+        for (j = 0; j < ESEM_L; j++) {
+            ESEM_Precompute(publicAll[j], publicTable[j]);
+        }
+        Status = ESEM_Store_Add(dir, d, publicTable, keys);
+        if (Status != ECCRYPTO_SUCCESS) {
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    for (j = 0; j < ESEM_L; j++) {
+        free(publicAll[j]);
+        free(secretAll[j]);
+        free(publicTable[j]);
+    }
+    return Status;
+
+}
+
+
+static void *ESEM_Reload_Thread(void *arg){ // Reloads the device store on every SIGHUP, e.g. after re-provisioning devices with option (8)
+
+    esem_server_t *server = (esem_server_t*)arg;
+    sigset_t set;
+    int sig;
+    long start;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+    while (sigwait(&set, &sig) == 0) {
+        start = ESEM_Now_us();
+        if (ESEM_Server_Reload(server, server->storeDir) == ECCRYPTO_SUCCESS) {
+            printf("Device store reloaded in %.1f ms\n", (ESEM_Now_us() - start)/1000.0);
+        } else {
+            printf("Problem Occurred in reloading the device store %s, still serving the previous one\n", server->storeDir);
+        }
+        fflush(stdout);
+    }
+    return NULL;
+
+}
+
+
+ECCRYPTO_STATUS ESEM_Run_Server(esem_server_t *server, point_precomp_t *publicTable[ESEM_L], unsigned char *tempKey[ESEM_L], unsigned int cacheEntries, const char *storeDir){ // Sets up the server state around ESEM_Server_Pool, which returns only on error
+
+    ECCRYPTO_STATUS Status;
+    unsigned int i;
+    pthread_t reloader;
+    esem_stats_t *stats = NULL;
+    sigset_t set, oldSet;
+
+    atomic_init(&server->store, NULL);
+    if (storeDir != NULL) {
+        atomic_init(&server->store, ESEM_Store_Open(storeDir, ESEM_STORE_RESIDENT));
+        if (atomic_load(&server->store) == NULL) {
+            printf("Problem Occurred in opening the device store %s\n", storeDir);
+            return ECCRYPTO_ERROR;
+        }
+    }
+    server->storeDir = storeDir;
+    atomic_init(&server->version, 1);
+    server->readers = NULL;
+    server->nreaders = 0;
+    server->nodes = NULL;
+    server->nnodes = 0;
+    pthread_mutex_init(&server->reloadLock, NULL);
+    server->cache = ESEM_Cache_New(cacheEntries, ESEM_CACHE_SHARDS);   // NULL (no cache) for 0 entries
+    server->party = ESEM_Party_New(server->partyThreads);               // NULL (no party pool) for 0 threads
+    server->reportUs = ESEM_REPORT_US;
+    server->nextReportUs = 0;
+    server->lastReportRequests = 0;
+    atomic_init(&server->requests, 0);
+    atomic_init(&server->busy, 0);
+    pthread_mutex_init(&server->reportLock, NULL);
+    ESEM_Metrics_Init(&server->metrics);
+    for (i = 0; i < ESEM_L; i++) {
+        server->publicTable[i] = publicTable[i];
+        memmove(server->tempKey[i], tempKey[i], 32);
+    }
+    server->subsetBlock = ESEM_SUBSET_BLOCK;
+    for (i = 0; i < ESEM_L; i++) {
+        server->subsetTable[i] = (server->subsetBlock != 0) ? ESEM_Precompute_Subsets(server->publicTable[i], server->subsetBlock) : NULL;
+        if (server->subsetBlock != 0 && server->subsetTable[i] == NULL) {
+            printf("Problem Occurred in Precompute, serving from the plain tables\n");
+            server->subsetBlock = 0;
+        }
+    }
+
+    if (storeDir != NULL) {                                              // SIGHUP is blocked in all server threads and
+        sigemptyset(&set);                                               // taken by the reload thread
+        sigaddset(&set, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &set, &oldSet);
+        if (pthread_create(&reloader, NULL, ESEM_Reload_Thread, server) != 0) {
+            storeDir = NULL;
+        }
+    }
+
+    server->requestLog = NULL;
+    if (server->requestLogPath != NULL) {
+        server->requestLog = ESEM_Reqlog_Open(server->requestLogPath);
+        if (server->requestLog == NULL) {
+            printf("Problem Occurred in creating the request log %s\n", server->requestLogPath);
+        }
+    }
+
+    if (server->statsEndpoint != NULL) {
+        stats = ESEM_Stats_Start(server, server->statsEndpoint);
+        if (stats == NULL) {
+            printf("Problem Occurred in binding the stats socket %s\n", server->statsEndpoint);
+        }
+    }
+
+    Status = ESEM_Server_Pool(server, ESEM_ENDPOINT);
+    if (Status != ECCRYPTO_SUCCESS) {
+        printf("Problem Occurred in Server: %s\n", FourQ_get_error_message(Status));
+    }
+    if (storeDir != NULL) {
+        pthread_cancel(reloader);
+        pthread_join(reloader, NULL);
+    }
+    if (server->storeDir != NULL) {
+        pthread_sigmask(SIG_SETMASK, &oldSet, NULL);
+    }
+    ESEM_Stats_Stop(stats);
+    if (!ESEM_Reqlog_Close(server->requestLog)) {
+        printf("Problem Occurred in writing the request log %s\n", server->requestLogPath);
+    }
+    ESEM_Cache_Free(server->cache);
+    ESEM_Party_Free(server->party);
+    ESEM_Store_Close(atomic_load(&server->store));
+    for (i = 0; i < ESEM_L; i++) {
+        ESEM_Table_Free(server->subsetTable[i]);
+    }
+    pthread_mutex_destroy(&server->reportLock);
+    pthread_mutex_destroy(&server->reloadLock);
+
+    return Status;
+
+}
+
+
+int main(int argc, char *argv[])
 {
     //AES Key
     unsigned char sk_aes[32] = {0x54, 0xa2, 0xf8, 0x03, 0x1d, 0x18, 0xac, 0x77, 0xd2, 0x53, 0x92, 0xf2, 0x80, 0xb4, 0xb1, 0x2f, 0xac, 0xf1, 0x29, 0x3f, 0x3a, 0xe6, 0x77, 0x7d, 0x74, 0x15, 0x67, 0x91, 0x99, 0x53, 0x69, 0xc5}; 
@@ -717,9 +1260,17 @@ int main()
     unsigned char secret_key[32] =  {0x54, 0xa2, 0xf8, 0x03, 0x1d, 0x18, 0xac, 0x77, 0xd2, 0x53, 0x92, 0xf2, 0x80, 0xb4, 0xb1, 0x2f, 0xac, 0xf1, 0x29, 0x3f, 0x3a, 0xe6, 0x77, 0x7d, 0x74, 0x15, 0x67, 0x91, 0x99, 0x53, 0x69, 0xc5}; 
     unsigned char *publicAll_1, *publicAll_2, *publicAll_3, *secretAll_1, *secretAll_2, *secretAll_3, *message, *signature;
     unsigned char tempKey1[32], tempKey2[32], tempKey3[32], public_key[64]; //These are the keys to be shared with Parties.
+    point_precomp_t *publicTable_1, *publicTable_2, *publicTable_3; //Server-side copies of publicAll_1..3 in (x+y,y-x,2dt) form
+    esem_server_t server;
+    unsigned int cacheEntries, ndevices, keyVersion;
+    char storeDir[1024];
+    long startUs = ESEM_Now_us();
     publicAll_1 = malloc(BPV_N*64);
     publicAll_2 = malloc(BPV_N*64);
     publicAll_3 = malloc(BPV_N*64);
+    publicTable_1 = ESEM_Table_Alloc(BPV_N*sizeof(point_precomp_t));
+    publicTable_2 = ESEM_Table_Alloc(BPV_N*sizeof(point_precomp_t));
+    publicTable_3 = ESEM_Table_Alloc(BPV_N*sizeof(point_precomp_t));
     secretAll_1 = malloc(BPV_N*32);
     secretAll_2 = malloc(BPV_N*32);
     secretAll_3 = malloc(BPV_N*32);
@@ -747,6 +1298,29 @@ int main()
     if (Status != ECCRYPTO_SUCCESS) {
         printf("Problem Occurred in KeyGen");
     }
+    ESEM_Precompute(publicAll_1, publicTable_1);
+    ESEM_Precompute(publicAll_2, publicTable_2);
+    ESEM_Precompute(publicAll_3, publicTable_3);
+
+    point_precomp_t *publicTable[ESEM_L] = {publicTable_1, publicTable_2, publicTable_3};
+    unsigned char *tempKey[ESEM_L] = {tempKey1, tempKey2, tempKey3};
+
+    if (argc > 1 && strcmp(argv[1], "--daemon") == 0) { // ESEM --daemon [workers [batch window [microseconds [cache entries [device store or - [max queue [deadline us [numa [party threads [split classes [stats endpoint or - [request log or -]]]]]]]]]]]]
+        server.nworkers = (argc > 2) ? (unsigned int)atoi(argv[2]) : ESEM_WORKERS;
+        server.batchWindow = (argc > 3) ? (unsigned int)atoi(argv[3]) : ESEM_BATCH_WINDOW;
+        server.batchWindowUs = (argc > 4) ? atol(argv[4]) : ESEM_BATCH_WINDOW_US;
+        cacheEntries = (argc > 5) ? (unsigned int)atoi(argv[5]) : ESEM_CACHE_ENTRIES;
+        server.maxQueue = (argc > 7) ? (unsigned int)atoi(argv[7]) : ESEM_MAX_QUEUE;
+        server.deadlineUs = (argc > 8) ? atol(argv[8]) : ESEM_DEADLINE_US;
+        server.numa = (argc > 9) ? atoi(argv[9]) != 0 : ESEM_NUMA;
+        server.partyThreads = (argc > 10) ? (unsigned int)atoi(argv[10]) : ESEM_PARTY_THREADS;
+        server.splitClasses = (argc > 11) ? (unsigned int)strtoul(argv[11], NULL, 0) : ESEM_SPLIT_CLASSES;
+        server.statsEndpoint = (argc > 12) ? ((strcmp(argv[12], "-") != 0) ? argv[12] : NULL) : ESEM_STATS_ENDPOINT;
+        server.requestLogPath = (argc > 13) ? ((strcmp(argv[13], "-") != 0) ? argv[13] : NULL) : ESEM_REQUEST_LOG;
+        server.startUs = startUs;
+        Status = ESEM_Run_Server(&server, publicTable, tempKey, cacheEntries, (argc > 6 && strcmp(argv[6], "-") != 0) ? argv[6] : NULL);
+        goto cleanup;
+    }
 
 #if defined(HIGH_SPEED)
     printf("High Speed\n");
@@ -785,6 +1359,9 @@ int main()
             if (Status != ECCRYPTO_SUCCESS) {
                 printf("Problem Occurred in KeyGen");
             }
+            ESEM_Precompute(publicAll_1, publicTable_1);
+            ESEM_Precompute(publicAll_2, publicTable_2);
+            ESEM_Precompute(publicAll_3, publicTable_3);
         }
         else if(userType==2){
             printf("Signer\n");
@@ -815,9 +1392,9 @@ int main()
         else if(userType==3){
             printf("Server\n");
 #if defined(HIGH_SPEED)
-            Status = ESEM_Server_v2(publicAll_1, publicAll_2, publicAll_3, tempKey1, tempKey2, tempKey3);
+            Status = ESEM_Server_v2(publicTable_1, publicTable_2, publicTable_3, tempKey1, tempKey2, tempKey3, ESEM_TRANSPORT);
 #else
-            Status = ESEM_Server(publicAll_1, publicAll_2, publicAll_3, tempKey1, tempKey2, tempKey3);
+            Status = ESEM_Server(publicTable_1, publicTable_2, publicTable_3, tempKey1, tempKey2, tempKey3);
 #endif
 
             printf("Three (l) different servers are simulated in a single one, so three rounds of communication happens");
@@ -828,12 +1405,49 @@ int main()
         else if(userType==4){
             printf("Verifier\n");
             // memset(message, 1, 32);
-            ESEM_Verifier(signature, message, public_key);
+            ESEM_Verifier(signature, message, public_key, ESEM_TRANSPORT);
         }
         else if(userType==5){
             printf("Exiting\n");
             goto cleanup;
         }
+        else if(userType==6){
+            printf("Long-running Server\n");
+            printf("Worker threads, batch window (requests, microseconds), cache entries: ");
+            if (scanf("%u %u %ld %u", &server.nworkers, &server.batchWindow, &server.batchWindowUs, &cacheEntries) != 4) {
+                server.nworkers = ESEM_WORKERS;
+                server.batchWindow = ESEM_BATCH_WINDOW;
+                server.batchWindowUs = ESEM_BATCH_WINDOW_US;
+                cacheEntries = ESEM_CACHE_ENTRIES;
+            }
+            server.maxQueue = ESEM_MAX_QUEUE;
+            server.deadlineUs = ESEM_DEADLINE_US;
+            server.numa = ESEM_NUMA;
+            server.partyThreads = ESEM_PARTY_THREADS;
+            server.splitClasses = ESEM_SPLIT_CLASSES;
+            server.statsEndpoint = ESEM_STATS_ENDPOINT;
+            server.requestLogPath = ESEM_REQUEST_LOG;
+            server.startUs = ESEM_Now_us();
+            Status = ESEM_Run_Server(&server, publicTable, tempKey, cacheEntries, NULL);
+        }
+        else if(userType==7){
+            printf("Commitment Benchmark\n");
+            ESEM_Bench_Commit(publicTable_1, tempKey1);
+            ESEM_Bench_Pages(publicTable_1);
+            ESEM_Bench_Party(publicTable_1, tempKey1);
+            ESEM_Bench_Affine(publicTable_1, tempKey1);
+            ESEM_Bench_Transport();
+        }
+        else if(userType==8){
+            printf("Provision Device Store\n");
+            printf("Store directory, number of devices, key version: ");
+            if (scanf("%1023s %u %u", storeDir, &ndevices, &keyVersion) == 3) {
+                Status = ESEM_Provision(storeDir, ndevices, keyVersion, sk_aes, secret_key);
+                if (Status != ECCRYPTO_SUCCESS) {
+                    printf("Problem Occurred in Provision: %s\n", FourQ_get_error_message(Status));
+                }
+            }
+        }
         else
             goto cleanup;
     }
@@ -849,6 +1463,9 @@ cleanup:
     free(publicAll_1);
     free(publicAll_2);
     free(publicAll_3);
+    ESEM_Table_Free(publicTable_1);
+    ESEM_Table_Free(publicTable_2);
+    ESEM_Table_Free(publicTable_3);
 
     free(secretAll_1);
     free(secretAll_2);
@@ -0,0 +1,513 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: parameters, wire format and server interface shared by the ESEM programs
+************************************************************************************/
+
+#ifndef __ESEM_H__
+#define __ESEM_H__
+
+
+#include "../FourQ_api.h"
+#include "../FourQ_params.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define HIGH_SPEED 1
+
+#define CMD_REQUEST_VERIFICATION         0x000010
+
+// Benchmark and test parameters
+
+//For easy testing, no random keys are used in this implementation. secret_key, public_key should be generated new every time.
+
+#if defined(HIGH_SPEED) // This is ESEMv2
+    #define BENCH_LOOPS       100000      // Number of iterations per bench
+    #define BPV_V             40
+    #define ESEM_L            3
+    #define BPV_N             128
+#else
+    #define BENCH_LOOPS       100000
+    #define BPV_V             18
+    #define ESEM_L            3
+    #define BPV_N             1024
+#endif
+
+
+// Wire format between the verifier and the server
+// A request is x (16 bytes) followed by a party mask, where bit (j-1) selects party j. Several bits may be set, so
+// a verifier can fetch all ESEM_L partial commitments in a single round trip.
+// The reply is a multipart message with one 64-byte affine commitment per selected party, in increasing party order,
+// or a single empty frame if the request is malformed. A 16-byte request (no mask) is answered by the REP servers
+// with the next party in order, as in the original three-round protocol.
+// The high bits of the mask byte are response-format flags. With ESEM_FLAG_PROJECTIVE the server may skip the
+// normalization of a commitment and send it as a 128-byte (X,Y,Z,T) frame, T = XY/Z. With ESEM_FLAG_COMPRESSED, which
+// takes precedence, every commitment is sent as a 32-byte encoded point (see encode() in crypto_util.c). A verifier
+// should accept all frame sizes.
+// A request may carry a 4-byte little-endian device ID after the mask byte. Such requests are answered from the tables
+// of that device in the server's device store, and are malformed if the server has no store or does not know the
+// device. Requests without a device ID use the tables the server was started with.
+// A server that is overloaded, or could not answer a request within its deadline, replies with a single ESEM_BUSY
+// byte instead. The verifier may retry later.
+// ESEM_FLAG_URGENT in the mask byte puts a request in the latency-sensitive class (ESEM_CLASS_URGENT), e.g. for the
+// verification of a therapy change. The server may compute the parties of such requests in parallel.
+// A batched request carries the x of up to ESEM_MAX_SIGNATURES signatures, e.g. from a verifier draining a queue of
+// stored signatures: ESEM_BATCH_TAG, the number K of entries, then K entries of ESEM_ENTRY_BYTES, each an x, its mask
+// byte and a device ID, ESEM_DEVICE_BUILTIN for the tables the server was started with (see ESEM_Batch_Request). The
+// reply is one multipart message holding, entry after entry, the frames each entry would get as a request of its own:
+// its commitments, or a single empty frame if the entry is malformed. The batch as a whole may be answered busy.
+// Batched requests are served by the long-running server.
+// The long-running server echoes the routing envelope of a request in front of its reply: at most ESEM_MAX_ROUTE
+// frames, counting the arrival time its broker adds, the identity its ROUTER socket adds and the frames of the peer,
+// e.g. the empty delimiter of a REQ socket, or a sequence number and the delimiter for ESEM_loadgen. Every proxy in
+// between adds an identity. A request with a deeper envelope is dropped without a reply, and counted in
+// esem_dropped_total.
+
+#define ESEM_X_BYTES          16
+#define ESEM_POINT_BYTES      64
+#define ESEM_PROJ_BYTES       128
+#define ESEM_COMPRESSED_BYTES 32
+#define ESEM_MAX_FRAME_BYTES  ESEM_PROJ_BYTES
+#define ESEM_REQUEST_BYTES    (ESEM_X_BYTES+1)
+#define ESEM_DEVICE_BYTES     4
+#define ESEM_DEVICE_REQUEST_BYTES (ESEM_REQUEST_BYTES+ESEM_DEVICE_BYTES)
+#define ESEM_DEVICE_BUILTIN   0xFFFFFFFF  // Device ID of a batch entry for the server's own tables, never provisioned
+#define ESEM_BATCH_TAG        0xBA        // First byte of a batched request
+#define ESEM_BATCH_HEADER_BYTES 2
+#define ESEM_ENTRY_BYTES      ESEM_DEVICE_REQUEST_BYTES
+#define ESEM_MAX_SIGNATURES   64          // Entries of a batched request
+#define ESEM_BATCH_BYTES(k)   (ESEM_BATCH_HEADER_BYTES+(k)*ESEM_ENTRY_BYTES)
+#define ESEM_MAX_REQUEST_BYTES ESEM_BATCH_BYTES(ESEM_MAX_SIGNATURES)
+#define ESEM_PARTY_ALL        ((1 << ESEM_L) - 1)
+#define ESEM_FLAG_PROJECTIVE  0x80
+#define ESEM_FLAG_COMPRESSED  0x40
+#define ESEM_FLAGS            (ESEM_FLAG_PROJECTIVE | ESEM_FLAG_COMPRESSED)
+#define ESEM_FLAG_URGENT      0x20
+#define ESEM_CLASS_NORMAL     0           // Request classes, see ESEM_Class
+#define ESEM_CLASS_URGENT     1
+#define ESEM_CLASSES          2
+#define ESEM_BUSY             0xB5        // Payload of the one-byte busy reply
+#define ESEM_VERIFIER_FLAGS   ESEM_FLAG_COMPRESSED    // Response format requested by ESEM_Verifier: ESEM_FLAG_COMPRESSED for
+                                                      // constrained links, ESEM_FLAG_PROJECTIVE to save the decoding
+
+
+// Transports between ESEM_Verifier and ESEM_Server_v2, see ESEM_transport.c. Both ends must use the same one
+
+#define ESEM_TRANSPORT_ZMQ    0           // ZMQ_REQ/ZMQ_REP
+#define ESEM_TRANSPORT_URING  1           // Length-prefixed frames over TCP, driven by io_uring
+#define ESEM_TRANSPORT_SHM    2           // Rings in shared memory, for a verifier on the same host as the server
+#define ESEM_TRANSPORTS       3
+#define ESEM_TRANSPORT        ESEM_TRANSPORT_ZMQ  // Transport of the menu's server and verifier
+#define ESEM_CONNECT_ENDPOINT "tcp://localhost:5555"
+#define ESEM_BENCH_ENDPOINT   "tcp://*:5557"  // Loopback endpoint of the transport benchmark
+#define ESEM_BENCH_CONNECT_ENDPOINT "tcp://localhost:5557"
+#define ESEM_TRANSPORT_BUFFER_BYTES 4096  // Largest message of the native transports, frames and headers included
+#define ESEM_SHM_RING_BYTES   65536       // Size of each shared-memory ring, a power of two
+#define ESEM_SHM_SPIN         20000       // Polls of a shared-memory ring before sleeping, on hosts with more than one cpu
+#define ESEM_SHM_WAIT_MS      100         // Longest futex sleep before checking that the peer is still there
+
+
+// Server parameters
+
+#define ESEM_ENDPOINT         "tcp://*:5555"
+#define ESEM_STATS_ENDPOINT   "tcp://*:5556"  // Default stats socket: any request is answered with the metrics in Prometheus text format
+#define ESEM_BACKEND          "inproc://esem_workers"
+#define ESEM_WORKERS          4           // Default number of worker threads
+#define ESEM_BATCH_WINDOW     16          // Default number of requests normalized together
+#define ESEM_BATCH_WINDOW_US  200         // Default time to wait for a batch to fill, in microseconds
+#define ESEM_MAX_BATCH        256
+#define ESEM_MAX_ENTRIES      (ESEM_MAX_BATCH+ESEM_MAX_SIGNATURES-1)  // Signatures per batch: a batch stops taking requests
+                                                                     // once it holds batchWindow signatures
+#define ESEM_MAX_ROUTE        8           // Maximum number of routing frames in front of a request, see the wire format
+#define ESEM_CACHE_ENTRIES    65536       // Default capacity of the commitment cache (0 disables it)
+#define ESEM_CACHE_SHARDS     16
+#define ESEM_REPORT_US        10000000    // Interval between two reports of the server counters, in microseconds
+#define ESEM_SUBSET_BLOCK     0           // Table indices per subset-sum block used by the server (0 keeps the plain tables)
+#define ESEM_SUBSET_MAX_BLOCK 8           // A table of blocks of b indices holds ceil(BPV_N/b)*(2^b-1) entries
+#define ESEM_STORE_RESIDENT   4096        // Default number of devices of the store kept mapped
+#define ESEM_MAX_QUEUE        1024        // Default number of requests admitted to the workers at a time, more are answered busy
+#define ESEM_DEADLINE_US      100000      // Default time after its arrival a request is answered busy instead of computed (0: none)
+#define ESEM_BUSY_RETRIES     4           // Verifier retries of a busy request, after 1, 2, 4... times ESEM_BUSY_BACKOFF_US
+#define ESEM_BUSY_BACKOFF_US  10000
+#define ESEM_NUMA             0           // Default for pinning the workers and replicating the tables per NUMA node
+#define ESEM_NUMA_MAX_NODES   8
+#define ESEM_NUMA_MAX_NODE_ID 64
+#define ESEM_NUMA_MAX_CPUS    256
+#define ESEM_PAGES_SMALL      0           // Page sizes for the public tables, see ESEM_Table_Alloc_Pages
+#define ESEM_PAGES_TRANSPARENT 1
+#define ESEM_PAGES_HUGETLB    2
+#define ESEM_TABLE_PAGES      ESEM_PAGES_HUGETLB  // Largest page size tried for the public tables, smaller ones are the fallback
+#define ESEM_REPLY_ARENAS     4           // Reply buffers per worker that ZMQ may still be sending from while the next batch is built
+#define ESEM_PARTY_THREADS    (ESEM_L-1)  // Default number of threads sharing the parties of a request with its worker (0: none)
+#define ESEM_HIST_BUCKETS     48          // Histogram bucket b counts the values of bit length b, i.e. up to 2^b-1
+#define ESEM_STATS_BYTES      16384       // Maximum size of a metrics reply
+#define ESEM_SPLIT_CLASSES    (1 << ESEM_CLASS_URGENT)  // Default classes whose parties are computed in parallel, bit c for
+                                                        // class c. Lower latency for them, fewer requests/s overall
+#ifndef ESEM_TRACE
+#define ESEM_TRACE            0           // 1 compiles in the trace points of the server and the verifier, see make TRACE=TRUE
+#endif
+#define ESEM_TRACE_EVENTS     65536       // Trace events kept per thread, a power of two. The oldest are overwritten
+#define ESEM_TRACE_NAME_BYTES 16
+#define ESEM_TRACE_MAGIC      "ESEMTRC1"  // First bytes of a trace snapshot, see ESEM_Trace_Snapshot
+#define ESEM_TRACE_REQUEST    "trace"     // Stats socket request answered with a trace snapshot instead of the metrics
+#define ESEM_TRACE_FILE       "esem_verifier.trace"  // Trace snapshot written by ESEM_Verifier
+#define ESEM_REQUEST_LOG      NULL        // Default file the long-running server logs the requests it receives to, NULL for none
+#define ESEM_REQUEST_LOG_MAGIC "ESEMREQ1" // First bytes of a request log, see ESEM_Reqlog_Open
+#define ESEM_REQUEST_LOG_FLUSH_US 1000000 // Time between flushes of the request log, the records lost if the server is killed
+
+
+// Trace events. A span of an event is recorded by ESEM_TRACE_BEGIN and ESEM_TRACE_END on the same thread, and spans
+// nest. The trace points compile to nothing unless ESEM_TRACE is 1, and ESEM_tracedump converts the snapshots of a
+// server (taken over its stats socket) or of the verifier to Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+
+#define ESEM_EV_RECV          0           // Collecting the requests of a batch, or waiting for a reply
+#define ESEM_EV_INDICES       1           // blake2b derivation of the table indices
+#define ESEM_EV_GATHER        2           // Gathering the table entries of independent aggregations
+#define ESEM_EV_AGGREGATE     3           // Point additions
+#define ESEM_EV_NORMALIZE     4           // eccnorm_batch
+#define ESEM_EV_SEND          5
+#define ESEM_EV_BATCH         6           // A whole batch, from its first request to its last reply
+#define ESEM_EV_PARTY         7           // A partial commitment computed for the party pool
+#define ESEM_EV_DECODE        8           // Decoding a commitment frame
+#define ESEM_EV_VERIFY        9           // Hash, double scalar multiplication and comparison of a verification
+#define ESEM_EV_COUNT         10
+
+#if ESEM_TRACE
+    #define ESEM_TRACE_BEGIN(event, arg)  ESEM_Trace_Event((event), 'B', (arg))
+    #define ESEM_TRACE_END(event, arg)    ESEM_Trace_Event((event), 'E', (arg))
+    #define ESEM_TRACE_THREAD(name, index) ESEM_Trace_Thread((name), (index))
+#else
+    #define ESEM_TRACE_BEGIN(event, arg)
+    #define ESEM_TRACE_END(event, arg)
+    #define ESEM_TRACE_THREAD(name, index)
+#endif
+
+
+// Cache of encoded partial commitments, keyed by (table id, x)
+typedef struct esem_cache esem_cache_t;
+
+// Tables of one device
+typedef struct {
+    uint32_t id;
+    uint64_t key;                          // Table id of party j in the commitment cache is key | j
+    int node;                              // NUMA node holding the tables, -1 if unknown
+    point_precomp_t *publicTable[ESEM_L];
+    unsigned char *tempKey[ESEM_L];
+} esem_device_t;
+
+// A NUMA node serving requests, with its own replica of the server's tables and its own counters
+typedef struct {
+    int id;                                // Node number, -1 if the workers are not placed on nodes
+    unsigned int ncpus;
+    int cpu[ESEM_NUMA_MAX_CPUS];
+    pthread_mutex_t lock;
+    bool replicated;                       // publicTable and subsetTable below are set
+    point_precomp_t *publicTable[ESEM_L];  // Copies of server->publicTable and server->subsetTable first touched on the
+    point_precomp_t *subsetTable[ESEM_L];  // node, or the server's own tables if id is -1
+    atomic_ulong requests;                 // Requests answered by the workers of the node
+    atomic_ulong commitments;              // Partial commitments computed by them, from tables on another node for
+    atomic_ulong remote;                   // "remote" of them
+    unsigned long lastReportRequests;
+} esem_node_t;
+
+// Histogram with power-of-two buckets, updated without locks
+typedef struct {
+    atomic_ulong bucket[ESEM_HIST_BUCKETS];
+    atomic_ulong sum;
+} esem_hist_t;
+
+// Server metrics other than the request and busy counters. All updates are relaxed atomic additions, cheap enough to
+// stay on in production; readers may see the fields of a histogram slightly out of step
+typedef struct {
+    atomic_ulong commitments;              // Partial commitments computed, i.e. not served from the cache
+    atomic_ulong signatures;               // Entries answered, one per request that is not batched
+    atomic_ulong batches;
+    atomic_ulong dropped;                  // Requests dropped for a routing envelope deeper than ESEM_MAX_ROUTE
+    atomic_ulong queueDepth;               // Requests admitted by the broker and not answered yet
+    atomic_ulong partyCycles[ESEM_L];      // Aggregation cycles spent on each party, shared evenly within a group
+    atomic_ulong partyCommitments[ESEM_L];
+    esem_hist_t latencyUs;                 // Per request, from its arrival at the server to its reply
+    esem_hist_t batchSize;                 // Requests per batch
+    esem_hist_t aggregationCycles;         // Per computed commitment
+    esem_hist_t normalizationCycles;       // Per batch, of eccnorm_batch
+} esem_metrics_t;
+
+// Trace event, as written by ESEM_Trace_Event. phase is 'B' or 'E', for the beginning and the end of a span
+typedef struct {
+    uint64_t ns;                           // CLOCK_MONOTONIC time
+    uint32_t arg;                          // Event-specific, e.g. the number of requests of a batch
+    uint16_t event;                        // ESEM_EV_*
+    uint8_t phase;
+    uint8_t reserved;
+} esem_trace_event_t;
+
+// Trace events of one thread
+typedef struct esem_trace_ring esem_trace_ring_t;
+
+// Record of a request log, one per signature. A request is the record with its entries field set and the entries - 1
+// records that follow it. All integers in host byte order
+typedef struct {
+    uint64_t us;                           // Arrival time at the server, CLOCK_MONOTONIC
+    uint32_t device;                       // ESEM_DEVICE_BUILTIN for the tables the server was started with
+    uint8_t mask;                          // Mask byte, flags included
+    uint8_t entries;                       // Signatures of the request the record starts, 0 if it does not start one
+    uint8_t batched;                       // 1 if the request was a batched request
+    uint8_t reserved;
+    unsigned char x[ESEM_X_BYTES];
+} esem_reqlog_record_t;
+
+// Request log being written
+typedef struct esem_reqlog esem_reqlog_t;
+
+// Connection of a verifier to a server, or listening server, over one of the ESEM_TRANSPORT_* transports
+typedef struct esem_transport esem_transport_t;
+
+// Thread answering the stats socket
+typedef struct esem_stats esem_stats_t;
+
+// Store of the tables of many devices, mapped from disk on demand
+typedef struct esem_store esem_store_t;
+
+// Threads computing partial commitments handed over by the workers
+typedef struct esem_party_pool esem_party_pool_t;
+
+// One partial commitment for the party pool
+typedef struct {
+    point_precomp_t *table;                // Public table of the party, or its subset-sum table if block != 0
+    unsigned int block;
+    unsigned char *tempKey;
+    unsigned char *randValue;
+    point_extproj *R;                      // Result
+    int64_t cycles;                        // Cycles the aggregation took, set by the pool
+    unsigned int *remaining;               // Jobs of the same caller not completed yet, see ESEM_Party_Wait
+} esem_party_job_t;
+
+
+typedef struct {
+    point_precomp_t *publicTable[ESEM_L];  // publicAll_1..ESEM_L in (x+y,y-x,2dt) form
+    point_precomp_t *subsetTable[ESEM_L];  // Subset sums of publicTable, used instead of it if subsetBlock != 0
+    unsigned int subsetBlock;
+    unsigned char tempKey[ESEM_L][32];     // Keys shared with the parties
+    unsigned int batchWindow;              // Maximum number of requests, and of signatures, per batch (1 disables batching)
+    long batchWindowUs;                    // Maximum time to wait for a batch to fill, in microseconds
+    unsigned int nworkers;                 // Number of worker threads (0 serves in the calling thread)
+    unsigned int maxQueue;                 // Maximum number of requests queued or in progress at the workers (0: no limit)
+    long deadlineUs;                       // Requests older than this when their batch starts are answered busy (0: never)
+    atomic_ulong busy;                     // Busy replies sent
+    esem_cache_t *cache;                   // Commitment cache shared by the workers, or NULL
+    unsigned int partyThreads;             // Threads of the party pool (0: every request is computed by its worker alone)
+    unsigned int splitClasses;             // Bit c set: the parties of requests of class c are spread over the party pool
+    esem_party_pool_t *party;              // Party pool shared by the workers, set while the server runs
+    esem_store_t * _Atomic store;          // Tables of the devices named in requests, or NULL. Replaced by ESEM_Server_Reload
+    const char *storeDir;                  // Directory the store is loaded from
+    atomic_ulong version;                  // Incremented by every replacement of the store, starts at 1
+    atomic_ulong *readers;                 // Per worker: version seen at the start of its current batch, 0 if idle
+    unsigned int nreaders;
+    bool numa;                             // Pin the workers and replicate the tables on each NUMA node, and send the
+                                           // requests for a device to its home node
+    esem_node_t *nodes;                    // Nodes the workers run on, set while the server runs
+    unsigned int nnodes;
+    long startUs;                          // Time the process started setting up the server, 0 if unknown
+    atomic_ulong requests;                 // Requests answered since the server started
+    long reportUs;                         // Interval between reports of the counters (0 disables them)
+    long nextReportUs, lastReportUs;
+    unsigned long lastReportRequests;
+    pthread_mutex_t reportLock;
+    pthread_mutex_t reloadLock;            // Serializes ESEM_Server_Reload against itself and the setup of readers
+    esem_metrics_t metrics;
+    const char *statsEndpoint;             // Endpoint of the stats socket, NULL for none
+    const char *requestLogPath;            // File the requests are logged to, NULL for none
+    esem_reqlog_t *requestLog;             // Written by the broker, or by ESEM_Serve if there is no broker
+} esem_server_t;
+
+
+void print_hex(unsigned char* arr, int len);
+
+// Monotonic clock in microseconds
+long ESEM_Now_us(void);
+
+// Computes the partial commitment R of one party for x in projective coordinates
+void ESEM_Commit(point_precomp_t *publicTable, unsigned char tempKey[32], unsigned char randValue[16], point_extproj_t R);
+
+// Computes four independent partial commitments, R[k] for (publicTable[k], tempKey[k], randValue[k]), in parallel lanes
+void ESEM_Commit_x4(point_precomp_t *publicTable[4], unsigned char *tempKey[4], unsigned char *randValue[4], point_extproj_t R[4]);
+
+// Computes count <= MADD_MAX_LANES independent partial commitments, advancing their aggregations in lock-step
+void ESEM_Commit_Interleaved(point_precomp_t *publicTable[], unsigned char *tempKey[], unsigned char *randValue[], unsigned int count, point_extproj_t R[]);
+
+// Computes count independent partial commitments directly in affine coordinates, with one inversion per addition level
+ECCRYPTO_STATUS ESEM_Commit_Affine_Batch(point_precomp_t *publicTable[], unsigned char *tempKey[], unsigned char *randValue[], unsigned int count, point_t *R);
+
+// Precomputes the sums of all subsets of each block of "block" consecutive entries of publicTable. Returns NULL on failure
+point_precomp_t* ESEM_Precompute_Subsets(point_precomp_t *publicTable, unsigned int block);
+
+// Computes the same R as ESEM_Commit from a subset-sum table, returns the number of point additions performed
+unsigned int ESEM_Commit_Subsets(point_precomp_t *subsetTable, unsigned int block, unsigned char tempKey[32], unsigned char randValue[16], point_extproj_t R);
+
+// Returns the party mask selected by a request, or 0 if the request is malformed
+unsigned int ESEM_Parties(unsigned char *request, int requestLen);
+
+// Returns the response-format flags of a request
+unsigned int ESEM_Flags(unsigned char *request, int requestLen);
+
+// Returns the class of a request, ESEM_CLASS_NORMAL if it has no mask byte
+unsigned int ESEM_Class(unsigned char *request, int requestLen);
+
+// Returns true and sets *device if the request names a device
+bool ESEM_Device(unsigned char *request, int requestLen, uint32_t *device);
+
+// Splits a request into its entries: the K entries of a batched request, or the request itself. Returns their number,
+// entry[e] and entryLen[e] being the bytes of entry e, to be passed to ESEM_Parties, ESEM_Flags, ESEM_Class and ESEM_Device
+unsigned int ESEM_Entries(unsigned char *request, int requestLen, unsigned char *entry[ESEM_MAX_SIGNATURES], int entryLen[ESEM_MAX_SIGNATURES]);
+
+// Writes the batched request for count <= ESEM_MAX_SIGNATURES signatures into request, returns its length
+int ESEM_Batch_Request(unsigned char *request, unsigned char *x[], const unsigned char mask[], const uint32_t device[], unsigned int count);
+
+// Encodes R as a 128-byte (X,Y,Z,T) frame, without inversion
+void ESEM_Encode_Projective(point_extproj_t R, unsigned char encoded[ESEM_PROJ_BYTES]);
+
+// Replaces the 64-byte affine commitment in frame by its 32-byte compressed encoding
+void ESEM_Encode_Compressed(unsigned char frame[ESEM_POINT_BYTES]);
+
+// Decodes a 32-byte compressed, 64-byte affine or 128-byte projective commitment frame. Returns false for any other
+// length, or if a compressed point does not decode to a point on the curve
+bool ESEM_Decode_Commitment(unsigned char *frame, int frameLen, point_extproj_t R);
+
+// Commitment cache with room for about "capacity" entries, split over "nshards" independently locked shards
+esem_cache_t* ESEM_Cache_New(unsigned int capacity, unsigned int nshards);
+void ESEM_Cache_Free(esem_cache_t *cache);
+
+// Copies the commitment cached for (table, x) and returns true, or returns false on a miss
+bool ESEM_Cache_Get(esem_cache_t *cache, uint64_t table, const unsigned char x[ESEM_X_BYTES], unsigned char commitment[ESEM_POINT_BYTES]);
+
+// Caches the commitment for (table, x), evicting the least recently used entry of its shard if needed
+void ESEM_Cache_Put(esem_cache_t *cache, uint64_t table, const unsigned char x[ESEM_X_BYTES], const unsigned char commitment[ESEM_POINT_BYTES]);
+
+// Hit and miss counters summed over all shards
+void ESEM_Cache_Stats(esem_cache_t *cache, uint64_t *hits, uint64_t *misses);
+
+// Appends the tables and keys of a device to the store in directory dir, creating it if needed
+ECCRYPTO_STATUS ESEM_Store_Add(const char *dir, uint32_t device, point_precomp_t *publicTable[ESEM_L], unsigned char *tempKey[ESEM_L]);
+
+// Opens the store in directory dir, keeping at most "resident" devices mapped. Returns NULL on failure
+esem_store_t* ESEM_Store_Open(const char *dir, unsigned int resident);
+void ESEM_Store_Close(esem_store_t *store);
+
+// Returns the tables of a device, mapped until the matching ESEM_Store_Release, or NULL if it is unknown or all
+// resident devices are in use
+esem_device_t* ESEM_Store_Acquire(esem_store_t *store, uint32_t id);
+void ESEM_Store_Release(esem_store_t *store, esem_device_t *device);
+
+// Maps in store the devices currently mapped in "from", typically the version of the store it replaces
+void ESEM_Store_Warm(esem_store_t *store, esem_store_t *from);
+
+// Number of devices in the store and currently mapped, and how often devices were mapped and evicted
+void ESEM_Store_Stats(esem_store_t *store, uint32_t *devices, uint32_t *resident, uint64_t *maps, uint64_t *evictions);
+
+// Clears the metrics
+void ESEM_Metrics_Init(esem_metrics_t *metrics);
+
+// Counts value in a histogram
+void ESEM_Hist_Add(esem_hist_t *hist, uint64_t value);
+
+// Writes the server counters and metrics in Prometheus text format to buf, returns the length written
+size_t ESEM_Metrics_Format(esem_server_t *server, char *buf, size_t size);
+
+// Starts a thread answering every request on a ZMQ_REP socket bound to endpoint with ESEM_Metrics_Format. NULL on failure
+esem_stats_t* ESEM_Stats_Start(esem_server_t *server, const char *endpoint);
+void ESEM_Stats_Stop(esem_stats_t *stats);
+
+// Server end of a transport bound to endpoint, or verifier end connected to it. NULL on failure. A server end that
+// is not ZeroMQ serves one verifier connection at a time, and accepts the next one when it closes
+esem_transport_t* ESEM_Transport_Bind(unsigned int kind, const char *endpoint);
+esem_transport_t* ESEM_Transport_Connect(unsigned int kind, const char *endpoint);
+void ESEM_Transport_Close(esem_transport_t *transport);
+
+// Sends one frame of a message, more is set on all frames but the last. Returns len, or -1 on failure. The message
+// may be held back until the next ESEM_Transport_Recv or ESEM_Transport_Close on the same end
+int ESEM_Transport_Send(esem_transport_t *transport, const void *data, size_t len, bool more);
+
+// Receives the next frame into buf, truncated to size, and tells whether more frames of the message follow.
+// Returns the length of the frame, or -1 on failure
+int ESEM_Transport_Recv(esem_transport_t *transport, void *buf, size_t size, bool *more);
+
+// Name of an ESEM_TRANSPORT_* transport
+const char* ESEM_Transport_Name(unsigned int kind);
+
+// Names of the ESEM_EV_* events
+extern const char *ESEM_Trace_Names[ESEM_EV_COUNT];
+
+// Appends an event to the ring of the calling thread, without locking. Use ESEM_TRACE_BEGIN and ESEM_TRACE_END
+void ESEM_Trace_Event(unsigned int event, char phase, uint32_t arg);
+
+// Names the calling thread in the trace, followed by index unless it is negative
+void ESEM_Trace_Thread(const char *name, int index);
+
+// Copies the events of all threads into a buffer to be freed by the caller, NULL on failure. Safe while they trace
+unsigned char* ESEM_Trace_Snapshot(size_t *len);
+
+// Writes ESEM_Trace_Snapshot to a file
+bool ESEM_Trace_Save(const char *path);
+
+// Creates a request log: ESEM_REQUEST_LOG_MAGIC, the wall-clock and the CLOCK_MONOTONIC time of the call in
+// microseconds as two uint64, then esem_reqlog_record_t's. NULL on failure
+esem_reqlog_t* ESEM_Reqlog_Open(const char *path);
+
+// Logs the well-formed entries of a request that arrived at arrivalUs. Does nothing if log is NULL. Called by the
+// single thread receiving the requests of a server, so that the log is in order of arrival
+void ESEM_Reqlog_Request(esem_reqlog_t *log, long arrivalUs, unsigned char *request, int requestLen);
+
+// Flushes and closes the log, returns false if some records could not be written
+bool ESEM_Reqlog_Close(esem_reqlog_t *log);
+
+// Pool of nthreads threads computing partial commitments, NULL if nthreads is 0 or on failure
+esem_party_pool_t* ESEM_Party_New(unsigned int nthreads);
+void ESEM_Party_Free(esem_party_pool_t *pool);
+
+// Queues n jobs sharing the counter *remaining, which the call increases by n. Jobs that do not fit in the queue
+// are computed right away by the caller
+void ESEM_Party_Post(esem_party_pool_t *pool, esem_party_job_t *jobs, unsigned int n);
+
+// Returns when *remaining is 0, computing queued jobs in the meantime
+void ESEM_Party_Wait(esem_party_pool_t *pool, unsigned int *remaining);
+
+// Zeroed memory for a public table, on pages of at most the given size (ESEM_PAGES_*), smaller ones being the fallback.
+// ESEM_Table_Alloc uses ESEM_TABLE_PAGES for tables of at least half a huge page. Released with ESEM_Table_Free
+void* ESEM_Table_Alloc_Pages(size_t bytes, unsigned int pages);
+void* ESEM_Table_Alloc(size_t bytes);
+void ESEM_Table_Free(void *table);
+
+// Page size (ESEM_PAGES_*) a table was allocated with
+unsigned int ESEM_Table_Pages(void *table);
+
+// Data TLB read misses of the calling thread between the two calls, -1 if they cannot be counted
+int ESEM_Tlb_Open(void);
+int64_t ESEM_Tlb_Close(int fd);
+
+// Fills in the NUMA nodes that have cpus and returns their number, or a single node with id -1 if there is no topology
+unsigned int ESEM_Numa_Discover(esem_node_t *nodes, unsigned int maxNodes);
+
+// Pins the calling thread to a cpu
+bool ESEM_Numa_Pin(int cpu);
+
+// NUMA node of the (faulted in) page holding addr, -1 if unknown
+int ESEM_Numa_Node_Of(const void *addr);
+
+// Long-running server that normalizes up to server->batchWindow pending requests with a single inversion
+ECCRYPTO_STATUS ESEM_Server_Batch(esem_server_t *server, const char *endpoint);
+
+// Long-running server with a ZMQ_ROUTER frontend, an inproc ZMQ_DEALER backend and server->nworkers worker threads.
+// At most server->maxQueue requests are admitted to the workers at a time, or any number if it is 0
+ECCRYPTO_STATUS ESEM_Server_Pool(esem_server_t *server, const char *endpoint);
+
+// Opens the device store in storeDir again and swaps it in for the one requests are served from. The old store is
+// closed once no worker can still be using it. Safe to call from any thread while the server runs
+ECCRYPTO_STATUS ESEM_Server_Reload(esem_server_t *server, const char *storeDir);
+
+
+#endif
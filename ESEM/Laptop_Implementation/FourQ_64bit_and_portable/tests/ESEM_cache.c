@@ -0,0 +1,230 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: bounded, sharded LRU cache of encoded partial commitments
+************************************************************************************/
+
+#include "ESEM.h"
+#include "../random/random.h"
+
+
+#define ESEM_CACHE_NONE       0xFFFFFFFF
+
+typedef struct {
+    uint64_t table;                        // Table id (party) the commitment was computed with
+    unsigned char x[ESEM_X_BYTES];
+    unsigned char commitment[ESEM_POINT_BYTES];
+    uint32_t next;                         // Next entry in the same bucket
+    uint32_t prev_lru, next_lru;           // Neighbours in the recency list, most recent first
+} esem_cache_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    esem_cache_entry_t *entries;
+    uint32_t *buckets;
+    uint32_t nentries, capacity, mask;
+    uint32_t head, tail;                   // Most and least recently used entries
+    uint64_t hits, misses;
+} esem_cache_shard_t;
+
+struct esem_cache {
+    esem_cache_shard_t *shards;
+    unsigned int nshards;
+    uint64_t seed;
+};
+
+
+static uint64_t ESEM_Cache_Hash(esem_cache_t *cache, uint64_t table, const unsigned char x[ESEM_X_BYTES])
+{ // Seeded hash of (table, x). x is chosen by the verifier, so the seed keeps bucket placement unpredictable
+
+    uint64_t h, w0, w1;
+
+    memcpy(&w0, x, 8);
+    memcpy(&w1, x + 8, 8);
+    h = cache->seed ^ (table * 0x9E3779B97F4A7C15ULL);
+    h = (h ^ w0) * 0xFF51AFD7ED558CCDULL;
+    h = (h ^ (h >> 33) ^ w1) * 0xC4CEB9FE1A85EC53ULL;
+    return h ^ (h >> 33);
+}
+
+
+esem_cache_t* ESEM_Cache_New(unsigned int capacity, unsigned int nshards)
+{ // Cache with room for (about) "capacity" commitments, split over "nshards" independently locked shards
+
+    esem_cache_t *cache;
+    unsigned int s;
+    uint32_t nbuckets, i;
+
+    if (capacity == 0 || nshards == 0) {
+        return NULL;
+    }
+    cache = calloc(1, sizeof(esem_cache_t));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->shards = calloc(nshards, sizeof(esem_cache_shard_t));
+    if (cache->shards == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->nshards = nshards;
+    random_bytes((unsigned char*)&cache->seed, sizeof(cache->seed));
+
+    for (s = 0; s < nshards; s++) {
+        esem_cache_shard_t *shard = &cache->shards[s];
+
+        shard->capacity = (capacity + nshards - 1)/nshards;
+        for (nbuckets = 1; nbuckets < 2*shard->capacity; nbuckets <<= 1);
+        shard->mask = nbuckets - 1;
+        shard->entries = malloc(shard->capacity*sizeof(esem_cache_entry_t));
+        shard->buckets = malloc(nbuckets*sizeof(uint32_t));
+        if (shard->entries == NULL || shard->buckets == NULL) {
+            cache->nshards = s + 1;
+            ESEM_Cache_Free(cache);
+            return NULL;
+        }
+        for (i = 0; i < nbuckets; i++) {
+            shard->buckets[i] = ESEM_CACHE_NONE;
+        }
+        shard->head = shard->tail = ESEM_CACHE_NONE;
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+
+    return cache;
+}
+
+
+void ESEM_Cache_Free(esem_cache_t *cache)
+{
+    unsigned int s;
+
+    if (cache == NULL) {
+        return;
+    }
+    for (s = 0; s < cache->nshards; s++) {
+        if (cache->shards[s].entries != NULL && cache->shards[s].buckets != NULL) {
+            pthread_mutex_destroy(&cache->shards[s].lock);
+        }
+        free(cache->shards[s].entries);
+        free(cache->shards[s].buckets);
+    }
+    free(cache->shards);
+    free(cache);
+}
+
+
+static void ESEM_Cache_Unlink(esem_cache_shard_t *shard, uint32_t e)
+{ // Removes entry e from the recency list
+
+    esem_cache_entry_t *entry = &shard->entries[e];
+
+    if (entry->prev_lru != ESEM_CACHE_NONE) shard->entries[entry->prev_lru].next_lru = entry->next_lru;
+    else shard->head = entry->next_lru;
+    if (entry->next_lru != ESEM_CACHE_NONE) shard->entries[entry->next_lru].prev_lru = entry->prev_lru;
+    else shard->tail = entry->prev_lru;
+}
+
+
+static void ESEM_Cache_Push(esem_cache_shard_t *shard, uint32_t e)
+{ // Inserts entry e as the most recently used one
+
+    esem_cache_entry_t *entry = &shard->entries[e];
+
+    entry->prev_lru = ESEM_CACHE_NONE;
+    entry->next_lru = shard->head;
+    if (shard->head != ESEM_CACHE_NONE) shard->entries[shard->head].prev_lru = e;
+    shard->head = e;
+    if (shard->tail == ESEM_CACHE_NONE) shard->tail = e;
+}
+
+
+static uint32_t ESEM_Cache_Find(esem_cache_shard_t *shard, uint64_t h, uint64_t table, const unsigned char x[ESEM_X_BYTES], uint32_t **link)
+{ // Returns the entry for (table, x), or ESEM_CACHE_NONE. *link points to the reference to the entry in its bucket
+
+    uint32_t e;
+
+    *link = &shard->buckets[h & shard->mask];
+    for (e = **link; e != ESEM_CACHE_NONE; e = **link) {
+        if (shard->entries[e].table == table && memcmp(shard->entries[e].x, x, ESEM_X_BYTES) == 0) {
+            return e;
+        }
+        *link = &shard->entries[e].next;
+    }
+    return ESEM_CACHE_NONE;
+}
+
+
+bool ESEM_Cache_Get(esem_cache_t *cache, uint64_t table, const unsigned char x[ESEM_X_BYTES], unsigned char commitment[ESEM_POINT_BYTES])
+{ // Looks up the commitment for (table, x) and marks it as recently used. Returns false on a miss
+
+    uint64_t h = ESEM_Cache_Hash(cache, table, x);
+    esem_cache_shard_t *shard = &cache->shards[(h >> 32) % cache->nshards];
+    uint32_t e, *link;
+
+    pthread_mutex_lock(&shard->lock);
+    e = ESEM_Cache_Find(shard, h, table, x, &link);
+    if (e == ESEM_CACHE_NONE) {
+        shard->misses++;
+        pthread_mutex_unlock(&shard->lock);
+        return false;
+    }
+    memcpy(commitment, shard->entries[e].commitment, ESEM_POINT_BYTES);
+    ESEM_Cache_Unlink(shard, e);
+    ESEM_Cache_Push(shard, e);
+    shard->hits++;
+    pthread_mutex_unlock(&shard->lock);
+
+    return true;
+}
+
+
+void ESEM_Cache_Put(esem_cache_t *cache, uint64_t table, const unsigned char x[ESEM_X_BYTES], const unsigned char commitment[ESEM_POINT_BYTES])
+{ // Inserts the commitment for (table, x), evicting the least recently used entry of the shard when it is full
+
+    uint64_t h = ESEM_Cache_Hash(cache, table, x);
+    esem_cache_shard_t *shard = &cache->shards[(h >> 32) % cache->nshards];
+    uint32_t e, *link;
+
+    pthread_mutex_lock(&shard->lock);
+    e = ESEM_Cache_Find(shard, h, table, x, &link);
+    if (e != ESEM_CACHE_NONE) {                               // Already cached by a concurrent request
+        ESEM_Cache_Unlink(shard, e);
+    } else {
+        if (shard->nentries < shard->capacity) {
+            e = shard->nentries++;
+        } else {                                              // Evict the least recently used entry
+            uint64_t hOld;
+            uint32_t *linkOld;
+
+            e = shard->tail;
+            hOld = ESEM_Cache_Hash(cache, shard->entries[e].table, shard->entries[e].x);
+            ESEM_Cache_Find(shard, hOld, shard->entries[e].table, shard->entries[e].x, &linkOld);
+            *linkOld = shard->entries[e].next;
+            ESEM_Cache_Unlink(shard, e);
+            ESEM_Cache_Find(shard, h, table, x, &link);       // The eviction may have changed the insertion point
+        }
+        shard->entries[e].table = table;
+        memcpy(shard->entries[e].x, x, ESEM_X_BYTES);
+        shard->entries[e].next = ESEM_CACHE_NONE;
+        *link = e;
+    }
+    memcpy(shard->entries[e].commitment, commitment, ESEM_POINT_BYTES);
+    ESEM_Cache_Push(shard, e);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+
+void ESEM_Cache_Stats(esem_cache_t *cache, uint64_t *hits, uint64_t *misses)
+{ // Sums the hit and miss counters of all shards
+
+    unsigned int s;
+
+    *hits = 0;
+    *misses = 0;
+    for (s = 0; s < cache->nshards; s++) {
+        pthread_mutex_lock(&cache->shards[s].lock);
+        *hits += cache->shards[s].hits;
+        *misses += cache->shards[s].misses;
+        pthread_mutex_unlock(&cache->shards[s].lock);
+    }
+}
@@ -0,0 +1,622 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: load generator measuring the throughput and the latency of the commitment server
+************************************************************************************/
+
+#include "ESEM.h"
+#include "zmq.h"
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+
+// Usage: ESEM_loadgen <endpoint> <connections> <seconds> <rate> [devices [zipf [signatures]]] > result.json
+// Drives a long-running server (ESEM --daemon) and prints the results as JSON. Each connection is a DEALER socket on
+// a thread of its own. With rate 0 the load is closed-loop: every connection sends its next request as soon as the
+// previous one is answered. Otherwise it is open-loop: rate requests/s in total, evenly spaced on each connection,
+// sent whether or not the earlier ones were answered.
+// Every request asks for all parties for a random x, from the tables of a device drawn among the IDs 0..devices-1
+// (see menu option 8) following a Zipf law of exponent zipf, 0 for uniform, or from the server's own tables if
+// devices is 0. With signatures > 1 every request is a batched request of that many entries.
+// Latencies are corrected for coordinated omission. In open loop a request's latency counts from the time it was due,
+// so a request held back by a stalled server or client does not look fast. In closed loop a stalled server also
+// keeps the connections from sending the requests they would have sent meanwhile, which are added back as in
+// HdrHistogram, with the mean round trip as the expected interval. Service times, from the actual send, are reported
+// as well. Busy replies, and replies other than the expected commitments, are counted apart from the latencies.
+//
+// Usage: ESEM_loadgen --replay <request log> <endpoint> [speed [connections]] > result.json
+// Replays a request log written by a server started with one (ESEM --daemon ... <request log>): the same requests,
+// sent open-loop at their original arrival times, or speed times faster. Request r goes out on connection
+// r % connections. Latencies count from the time a request was due, as in open loop.
+
+#define ESEM_LOADGEN_OUTSTANDING 16384     // Requests in flight per connection, a power of two
+#define ESEM_LOADGEN_DRAIN_MS    2000      // Time given to the last replies after the end of the run
+#define ESEM_LOADGEN_SUB_BITS    6         // A histogram bucket spans at most 1/2^ESEM_LOADGEN_SUB_BITS of its values
+#define ESEM_LOADGEN_BUCKETS     ((65 - ESEM_LOADGEN_SUB_BITS) << ESEM_LOADGEN_SUB_BITS)
+#define ESEM_LOADGEN_SLEEP_NS    50000     // Longest sleep between two sends less than a millisecond apart
+#define ESEM_LOADGEN_FREE        UINT64_MAX
+
+typedef struct {
+    uint64_t count[ESEM_LOADGEN_BUCKETS];
+    uint64_t total, sum, max;              // Values in nanoseconds
+} esem_loadgen_hist_t;
+
+typedef struct {
+    uint64_t seq;                          // ESEM_LOADGEN_FREE while no request uses the slot
+    uint64_t dueNs, sentNs;
+    unsigned int signatures, frames;       // Signatures of the request and commitments expected in the reply
+} esem_loadgen_slot_t;
+
+typedef struct {
+    void *context;
+    const char *endpoint;
+    unsigned int connections, devices, signatures;
+    double rate, zipf;
+    double *cdf;                           // Cumulative distribution of the devices, NULL if devices is 0
+    uint64_t startNs, endNs;
+    const char *trace;                     // Request log replayed, NULL for generated requests
+    esem_reqlog_record_t *record;
+    size_t *first;                         // Request r is made of the records first[r] to first[r+1] - 1
+    size_t requests;
+    double speed;
+} esem_loadgen_run_t;
+
+typedef struct {
+    esem_loadgen_run_t *run;
+    unsigned int index;
+    pthread_t thread;
+    uint64_t rng;
+    uint64_t sent, completed, signatures, busy, errors, inflight;
+    size_t next;                           // Next request of the log to replay
+    esem_loadgen_hist_t latency, service;
+    esem_loadgen_slot_t slot[ESEM_LOADGEN_OUTSTANDING];
+} esem_loadgen_conn_t;
+
+
+static uint64_t ESEM_Loadgen_Now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+
+static uint64_t ESEM_Loadgen_Random(uint64_t *state)
+{ // xorshift64*, one state per connection
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+
+static unsigned int ESEM_Loadgen_Bucket(uint64_t value)
+{ // Values below 2^(ESEM_LOADGEN_SUB_BITS+1) have a bucket each, larger ones share it with the values having the same
+  // ESEM_LOADGEN_SUB_BITS+1 leading bits
+
+    unsigned int shift;
+
+    if (value < (2ULL << ESEM_LOADGEN_SUB_BITS)) {
+        return (unsigned int)value;
+    }
+    shift = 63 - __builtin_clzll(value) - ESEM_LOADGEN_SUB_BITS;
+    return (shift << ESEM_LOADGEN_SUB_BITS) + (unsigned int)(value >> shift);
+}
+
+
+static uint64_t ESEM_Loadgen_Lowest(unsigned int bucket)
+{
+    unsigned int shift;
+
+    if (bucket < (2U << ESEM_LOADGEN_SUB_BITS)) {
+        return bucket;
+    }
+    shift = (bucket >> ESEM_LOADGEN_SUB_BITS) - 1;
+    return (uint64_t)(bucket - (shift << ESEM_LOADGEN_SUB_BITS)) << shift;
+}
+
+
+static uint64_t ESEM_Loadgen_Highest(unsigned int bucket)
+{
+    return (bucket + 1 < ESEM_LOADGEN_BUCKETS) ? ESEM_Loadgen_Lowest(bucket + 1) - 1 : UINT64_MAX;
+}
+
+
+static void ESEM_Loadgen_Add(esem_loadgen_hist_t *hist, uint64_t value, uint64_t count)
+{
+    hist->count[ESEM_Loadgen_Bucket(value)] += count;
+    hist->total += count;
+    hist->sum += value*count;
+    hist->max = (value > hist->max) ? value : hist->max;
+}
+
+
+static void ESEM_Loadgen_Merge(esem_loadgen_hist_t *to, const esem_loadgen_hist_t *from)
+{
+    unsigned int b;
+
+    for (b = 0; b < ESEM_LOADGEN_BUCKETS; b++) {
+        to->count[b] += from->count[b];
+    }
+    to->total += from->total;
+    to->sum += from->sum;
+    to->max = (from->max > to->max) ? from->max : to->max;
+}
+
+
+static void ESEM_Loadgen_Correct(esem_loadgen_hist_t *hist, uint64_t interval)
+{ // A round trip of v > interval stands for v - interval, v - 2*interval... down to interval as well: the requests a
+  // connection would have sent every interval had the server not stalled. Each bucket counts as its midpoint
+
+    uint64_t *count, missing, value;
+    unsigned int b;
+
+    count = malloc(sizeof(hist->count));
+    if (count == NULL || interval == 0) {
+        free(count);
+        return;
+    }
+    memcpy(count, hist->count, sizeof(hist->count));                    // The added values are not corrected again
+    for (b = 0; b < ESEM_LOADGEN_BUCKETS; b++) {
+        if (count[b] == 0) {
+            continue;
+        }
+        value = ESEM_Loadgen_Lowest(b) + (ESEM_Loadgen_Highest(b) - ESEM_Loadgen_Lowest(b))/2;
+        for (missing = (value > interval) ? value - interval : 0; missing >= interval; missing -= interval) {
+            ESEM_Loadgen_Add(hist, missing, count[b]);
+        }
+    }
+    free(count);
+}
+
+
+static double ESEM_Loadgen_Percentile_us(const esem_loadgen_hist_t *hist, double percentile)
+{ // Highest value of the bucket holding the percentile, at most the largest value recorded
+
+    uint64_t rank, seen = 0, value;
+    unsigned int b;
+
+    if (hist->total == 0) {
+        return 0;
+    }
+    rank = (uint64_t)(percentile/100*hist->total + 0.999999);
+    rank = (rank == 0) ? 1 : rank;
+    for (b = 0; b < ESEM_LOADGEN_BUCKETS - 1 && seen + hist->count[b] < rank; b++) {
+        seen += hist->count[b];
+    }
+    value = ESEM_Loadgen_Highest(b);
+    return ((value < hist->max) ? value : hist->max)/1000.0;
+}
+
+
+static void ESEM_Loadgen_Print_Hist(const char *name, const esem_loadgen_hist_t *hist, bool last)
+{
+    printf("  \"%s\": {\"count\": %llu, \"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}%s\n",
+           name, (unsigned long long)hist->total, (hist->total != 0) ? hist->sum/1000.0/hist->total : 0.0,
+           ESEM_Loadgen_Percentile_us(hist, 50), ESEM_Loadgen_Percentile_us(hist, 90), ESEM_Loadgen_Percentile_us(hist, 99),
+           ESEM_Loadgen_Percentile_us(hist, 99.9), hist->max/1000.0, last ? "" : ",");
+}
+
+
+static int ESEM_Loadgen_Single(unsigned char *request, const unsigned char *x, unsigned char mask, uint32_t device)
+{ // A request for a single signature, with the device ID unless it is ESEM_DEVICE_BUILTIN, returns its length
+
+    memcpy(request, x, ESEM_X_BYTES);
+    request[ESEM_X_BYTES] = mask;
+    if (device == ESEM_DEVICE_BUILTIN) {
+        return ESEM_REQUEST_BYTES;
+    }
+    request[ESEM_REQUEST_BYTES] = (unsigned char)device;
+    request[ESEM_REQUEST_BYTES+1] = (unsigned char)(device >> 8);
+    request[ESEM_REQUEST_BYTES+2] = (unsigned char)(device >> 16);
+    request[ESEM_REQUEST_BYTES+3] = (unsigned char)(device >> 24);
+    return ESEM_DEVICE_REQUEST_BYTES;
+}
+
+
+static int ESEM_Loadgen_Request(esem_loadgen_conn_t *conn, unsigned char *request)
+{ // A request for all parties of run->signatures random x, returns its length
+
+    esem_loadgen_run_t *run = conn->run;
+    unsigned char x[ESEM_MAX_SIGNATURES][ESEM_X_BYTES], *xs[ESEM_MAX_SIGNATURES], mask[ESEM_MAX_SIGNATURES];
+    uint32_t device[ESEM_MAX_SIGNATURES], lo, hi, mid;
+    uint64_t r;
+    double u;
+    unsigned int e;
+
+    for (e = 0; e < run->signatures; e++) {
+        r = ESEM_Loadgen_Random(&conn->rng);
+        memcpy(x[e], &r, 8);
+        r = ESEM_Loadgen_Random(&conn->rng);
+        memcpy(x[e] + 8, &r, 8);
+        xs[e] = x[e];
+        mask[e] = ESEM_PARTY_ALL | ESEM_VERIFIER_FLAGS;
+        device[e] = ESEM_DEVICE_BUILTIN;
+        if (run->cdf != NULL) {                                          // First device whose cumulative probability exceeds u
+            u = (ESEM_Loadgen_Random(&conn->rng) >> 11)*(1.0/9007199254740992.0);
+            for (lo = 0, hi = run->devices - 1; lo < hi; ) {
+                mid = lo + (hi - lo)/2;
+                if (run->cdf[mid] > u) {
+                    hi = mid;
+                } else {
+                    lo = mid + 1;
+                }
+            }
+            device[e] = lo;
+        }
+    }
+    if (run->signatures > 1) {
+        return ESEM_Batch_Request(request, xs, mask, device, run->signatures);
+    }
+    return ESEM_Loadgen_Single(request, x[0], mask[0], device[0]);
+}
+
+
+static int ESEM_Loadgen_Replay(esem_loadgen_run_t *run, size_t r, unsigned char *request, esem_loadgen_slot_t *slot)
+{ // Request r of the log as the server received it, returns its length. Sets the signatures and frames of the slot
+
+    esem_reqlog_record_t *record = &run->record[run->first[r]];
+    unsigned char *xs[ESEM_MAX_SIGNATURES], mask[ESEM_MAX_SIGNATURES];
+    uint32_t device[ESEM_MAX_SIGNATURES];
+    unsigned int e;
+
+    slot->signatures = (unsigned int)(run->first[r+1] - run->first[r]);
+    slot->frames = 0;
+    for (e = 0; e < slot->signatures; e++) {
+        xs[e] = record[e].x;
+        mask[e] = record[e].mask;
+        device[e] = record[e].device;
+        slot->frames += __builtin_popcount(mask[e] & ESEM_PARTY_ALL);
+    }
+    if (record[0].batched) {
+        return ESEM_Batch_Request(request, xs, mask, device, slot->signatures);
+    }
+    return ESEM_Loadgen_Single(request, xs[0], mask[0], device[0]);
+}
+
+
+static uint64_t ESEM_Loadgen_Due(esem_loadgen_run_t *run, size_t r)
+{ // Time at which request r of the log is sent, run->endNs once the connection has none left
+
+    uint64_t us0 = run->record[0].us, us;
+
+    if (r >= run->requests) {
+        return run->endNs;
+    }
+    us = run->record[run->first[r]].us;
+    return run->startNs + ((us > us0) ? (uint64_t)((us - us0)*1000/run->speed) : 0);
+}
+
+
+static bool ESEM_Loadgen_Send(esem_loadgen_conn_t *conn, void *socket, uint64_t dueNs)
+{ // Sends the next request behind its sequence number and an empty delimiter. False if all slots are in use
+
+    unsigned char request[ESEM_MAX_REQUEST_BYTES];
+    esem_loadgen_slot_t *slot = &conn->slot[conn->sent & (ESEM_LOADGEN_OUTSTANDING - 1)];
+    int len;
+
+    if (slot->seq != ESEM_LOADGEN_FREE) {
+        return false;
+    }
+    if (conn->run->record != NULL) {
+        len = ESEM_Loadgen_Replay(conn->run, conn->next, request, slot);
+        conn->next += conn->run->connections;
+    } else {
+        len = ESEM_Loadgen_Request(conn, request);
+        slot->signatures = conn->run->signatures;
+        slot->frames = conn->run->signatures*ESEM_L;
+    }
+    slot->seq = conn->sent;
+    slot->dueNs = dueNs;
+    slot->sentNs = ESEM_Loadgen_Now_ns();
+    zmq_send(socket, &slot->seq, sizeof(uint64_t), ZMQ_SNDMORE);
+    zmq_send(socket, NULL, 0, ZMQ_SNDMORE);
+    zmq_send(socket, request, len, 0);
+    conn->sent++;
+    conn->inflight++;
+    return true;
+}
+
+
+static void ESEM_Loadgen_Receive(esem_loadgen_conn_t *conn, void *socket)
+{ // Handles one reply: the sequence number, the delimiter, then ESEM_L commitments per signature or the busy byte
+
+    esem_loadgen_slot_t *slot = NULL;
+    zmq_msg_t part;
+    unsigned int frame, commitments = 0;
+    bool busy = false, error = false;
+    uint64_t seq, now;
+    int more;
+    size_t moreSize = sizeof(more);
+
+    zmq_msg_init(&part);
+    for (frame = 0; ; frame++) {
+        if (zmq_msg_recv(&part, socket, 0) == -1) {
+            break;
+        }
+        if (frame == 0 && zmq_msg_size(&part) == sizeof(uint64_t)) {
+            memcpy(&seq, zmq_msg_data(&part), sizeof(uint64_t));
+            slot = &conn->slot[seq & (ESEM_LOADGEN_OUTSTANDING - 1)];
+            slot = (slot->seq == seq) ? slot : NULL;
+        } else if (frame > 1) {
+            busy |= zmq_msg_size(&part) == 1 && *(unsigned char*)zmq_msg_data(&part) == ESEM_BUSY;
+            error |= zmq_msg_size(&part) == 0;
+            commitments++;
+        }
+        zmq_getsockopt(socket, ZMQ_RCVMORE, &more, &moreSize);
+        if (!more) {
+            break;
+        }
+    }
+    zmq_msg_close(&part);
+    if (slot == NULL) {                                                  // Not one of ours
+        return;
+    }
+
+    now = ESEM_Loadgen_Now_ns();
+    if (busy) {
+        conn->busy++;
+    } else if (error || commitments != slot->frames) {
+        conn->errors++;
+    } else {
+        ESEM_Loadgen_Add(&conn->latency, now - slot->dueNs, 1);
+        ESEM_Loadgen_Add(&conn->service, now - slot->sentNs, 1);
+        conn->completed++;
+        conn->signatures += slot->signatures;
+    }
+    slot->seq = ESEM_LOADGEN_FREE;
+    conn->inflight--;
+}
+
+
+static void ESEM_Loadgen_Poll(esem_loadgen_conn_t *conn, void *socket, uint64_t untilNs)
+{ // Waits for a reply until untilNs, then handles all replies that arrived. zmq_poll counts in milliseconds, shorter
+  // waits are short sleeps
+
+    zmq_pollitem_t items[1];
+    uint64_t now = ESEM_Loadgen_Now_ns(), wait;
+    struct timespec ts;
+
+    items[0].socket = socket;
+    items[0].events = ZMQ_POLLIN;
+    wait = (untilNs > now) ? untilNs - now : 0;
+    if (wait >= 1000000) {
+        zmq_poll(items, 1, (long)(wait/1000000));
+    } else if (zmq_poll(items, 1, 0) == 0 && wait != 0) {
+        ts.tv_sec = 0;
+        ts.tv_nsec = (long)((wait < ESEM_LOADGEN_SLEEP_NS) ? wait : ESEM_LOADGEN_SLEEP_NS);
+        nanosleep(&ts, NULL);
+    }
+    while (zmq_poll(items, 1, 0) > 0) {
+        ESEM_Loadgen_Receive(conn, socket);
+    }
+}
+
+
+static void *ESEM_Loadgen_Thread(void *arg)
+{
+    esem_loadgen_conn_t *conn = (esem_loadgen_conn_t*)arg;
+    esem_loadgen_run_t *run = conn->run;
+    void *socket = zmq_socket(run->context, ZMQ_DEALER);
+    int linger = 0, hwm = ESEM_LOADGEN_OUTSTANDING;
+    uint64_t now, dueNs, drainNs, intervalNs = 0;
+
+    zmq_setsockopt(socket, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_setsockopt(socket, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+    zmq_setsockopt(socket, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+    if (zmq_connect(socket, run->endpoint) != 0) {
+        zmq_close(socket);
+        return NULL;
+    }
+    dueNs = run->startNs;
+    if (run->record != NULL) {
+        conn->next = conn->index;
+        dueNs = ESEM_Loadgen_Due(run, conn->next);
+    } else if (run->rate > 0) {                                          // The connections take turns
+        intervalNs = (uint64_t)(1e9*run->connections/run->rate);
+        dueNs += intervalNs*conn->index/run->connections;
+    }
+
+    while ((now = ESEM_Loadgen_Now_ns()) < run->endNs || (run->record != NULL && dueNs < run->endNs)) {
+        if (run->record != NULL) {                                       // Every request of the log is sent, late if need be
+            while (dueNs <= now && dueNs < run->endNs && ESEM_Loadgen_Send(conn, socket, dueNs)) {
+                dueNs = ESEM_Loadgen_Due(run, conn->next);
+            }
+        } else if (run->rate > 0) {
+            while (dueNs <= now && dueNs < run->endNs && ESEM_Loadgen_Send(conn, socket, dueNs)) {
+                dueNs += intervalNs;                                     // Late requests are sent at once, still due earlier
+            }
+        } else if (conn->inflight == 0) {
+            ESEM_Loadgen_Send(conn, socket, now);
+        }
+        ESEM_Loadgen_Poll(conn, socket, ((run->rate > 0 || run->record != NULL) && dueNs < run->endNs) ? dueNs : run->endNs);
+    }
+    drainNs = run->endNs + ESEM_LOADGEN_DRAIN_MS*1000000ULL;            // Requests still unanswered then are lost
+    while (conn->inflight != 0 && ESEM_Loadgen_Now_ns() < drainNs) {
+        ESEM_Loadgen_Poll(conn, socket, drainNs);
+    }
+    zmq_close(socket);
+    return NULL;
+}
+
+
+static double* ESEM_Loadgen_Zipf(unsigned int devices, double exponent)
+{ // Cumulative probabilities of the devices, device d having a weight of 1/(d+1)^exponent
+
+    double *cdf = malloc(devices*sizeof(double)), total = 0;
+    unsigned int d;
+
+    if (cdf == NULL) {
+        return NULL;
+    }
+    for (d = 0; d < devices; d++) {
+        total += pow(d + 1, -exponent);
+        cdf[d] = total;
+    }
+    for (d = 0; d < devices; d++) {
+        cdf[d] /= total;
+    }
+    return cdf;
+}
+
+
+static bool ESEM_Loadgen_Trace(esem_loadgen_run_t *run, const char *path)
+{ // Loads the request log at path and splits it into requests. False if it cannot be read or is malformed
+
+    FILE *file = fopen(path, "rb");
+    size_t header = 8 + 2*sizeof(uint64_t), records = 0, i;
+    long size = 0;
+    char magic[8];
+    bool ok;
+
+    if (file == NULL) {
+        return false;
+    }
+    ok = fread(magic, 1, 8, file) == 8 && memcmp(magic, ESEM_REQUEST_LOG_MAGIC, 8) == 0 && fseek(file, 0, SEEK_END) == 0 &&
+         (size = ftell(file)) >= (long)header;
+    if (ok) {                                                            // A record cut short by a killed server is dropped
+        records = ((size_t)size - header)/sizeof(esem_reqlog_record_t);
+        run->record = malloc((records + 1)*sizeof(esem_reqlog_record_t));
+        run->first = malloc((records + 1)*sizeof(size_t));
+        ok = run->record != NULL && run->first != NULL && fseek(file, (long)header, SEEK_SET) == 0 &&
+             fread(run->record, sizeof(esem_reqlog_record_t), records, file) == records;
+    }
+    fclose(file);
+    for (i = 0, run->requests = 0; ok && i < records; i += run->record[i].entries) {
+        if (run->record[i].entries == 0 || run->record[i].entries > ESEM_MAX_SIGNATURES || records - i < run->record[i].entries ||
+            (run->record[i].entries > 1 && !run->record[i].batched)) {
+            ok = false;
+            break;
+        }
+        run->first[run->requests++] = i;
+    }
+    if (ok && run->requests == 0) {
+        ok = false;
+    }
+    if (ok) {
+        run->first[run->requests] = i;
+    }
+    return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+    esem_loadgen_run_t run;
+    esem_loadgen_conn_t **conn;
+    esem_loadgen_hist_t *latency, *service;
+    uint64_t sent = 0, completed = 0, busy = 0, errors = 0, lost = 0;
+    uint64_t signatures = 0;
+    double seconds = 0;
+    unsigned int c, s;
+
+    memset(&run, 0, sizeof(run));
+    if (argc >= 4 && strcmp(argv[1], "--replay") == 0) {
+        run.trace = argv[2];
+        run.endpoint = argv[3];
+        run.speed = (argc > 4) ? atof(argv[4]) : 1;
+        run.connections = (argc > 5) ? (unsigned int)atoi(argv[5]) : 1;
+        if (run.speed <= 0 || run.connections == 0) {
+            fprintf(stderr, "Invalid parameters, see %s without arguments\n", argv[0]);
+            return 2;
+        }
+        if (!ESEM_Loadgen_Trace(&run, run.trace)) {
+            fprintf(stderr, "Problem Occurred in reading the request log %s\n", run.trace);
+            return 1;
+        }
+    } else if (argc >= 5) {
+        run.endpoint = argv[1];
+        run.connections = (unsigned int)atoi(argv[2]);
+        seconds = atof(argv[3]);
+        run.rate = atof(argv[4]);
+        run.devices = (argc > 5) ? (unsigned int)strtoul(argv[5], NULL, 0) : 0;
+        run.zipf = (argc > 6) ? atof(argv[6]) : 0;
+        run.signatures = (argc > 7) ? (unsigned int)atoi(argv[7]) : 1;
+        if (run.connections == 0 || seconds <= 0 || run.rate < 0 || run.zipf < 0 || run.signatures == 0 ||
+            run.signatures > ESEM_MAX_SIGNATURES || run.devices >= ESEM_DEVICE_BUILTIN) {
+            fprintf(stderr, "Invalid parameters, see %s without arguments\n", argv[0]);
+            return 2;
+        }
+    } else {
+        fprintf(stderr, "Usage: %s <endpoint> <connections> <seconds> <rate, 0 for closed loop> [devices [zipf [signatures]]]\n"
+                        "       %s --replay <request log> <endpoint> [speed [connections]]\n", argv[0], argv[0]);
+        return 2;
+    }
+    run.cdf = (run.devices != 0) ? ESEM_Loadgen_Zipf(run.devices, run.zipf) : NULL;
+    conn = calloc(run.connections, sizeof(esem_loadgen_conn_t*));
+    latency = calloc(1, sizeof(esem_loadgen_hist_t));
+    service = calloc(1, sizeof(esem_loadgen_hist_t));
+    if ((run.devices != 0 && run.cdf == NULL) || conn == NULL || latency == NULL || service == NULL) {
+        fprintf(stderr, "Problem Occurred in allocating memory\n");
+        return 1;
+    }
+
+    run.context = zmq_ctx_new();
+    run.startNs = ESEM_Loadgen_Now_ns() + 100000000;                     // Leaves the connections time to be set up
+    if (run.record != NULL) {                                            // Ends right after the last request is due
+        run.endNs = ESEM_Loadgen_Due(&run, run.requests - 1) + 1;
+        seconds = (run.endNs - run.startNs)/1e9;
+        run.rate = run.requests/seconds;
+    } else {
+        run.endNs = run.startNs + (uint64_t)(seconds*1e9);
+    }
+    for (c = 0; c < run.connections; c++) {
+        conn[c] = calloc(1, sizeof(esem_loadgen_conn_t));
+        if (conn[c] == NULL) {
+            fprintf(stderr, "Problem Occurred in allocating memory\n");
+            return 1;
+        }
+        conn[c]->run = &run;
+        conn[c]->index = c;
+        conn[c]->rng = ESEM_Loadgen_Now_ns()*(2*c + 1) | 1;
+        for (s = 0; s < ESEM_LOADGEN_OUTSTANDING; s++) {
+            conn[c]->slot[s].seq = ESEM_LOADGEN_FREE;
+        }
+        if (pthread_create(&conn[c]->thread, NULL, ESEM_Loadgen_Thread, conn[c]) != 0) {
+            fprintf(stderr, "Problem Occurred in starting connection %u\n", c);
+            return 1;
+        }
+    }
+    for (c = 0; c < run.connections; c++) {
+        pthread_join(conn[c]->thread, NULL);
+        sent += conn[c]->sent;
+        completed += conn[c]->completed;
+        signatures += conn[c]->signatures;
+        busy += conn[c]->busy;
+        errors += conn[c]->errors;
+        lost += conn[c]->inflight;
+        ESEM_Loadgen_Merge(latency, &conn[c]->latency);
+        ESEM_Loadgen_Merge(service, &conn[c]->service);
+    }
+    zmq_ctx_term(run.context);
+    if (run.rate == 0 && run.record == NULL && service->total != 0) {
+        ESEM_Loadgen_Correct(latency, service->sum/service->total);
+    }
+
+    printf("{\n  \"endpoint\": \"%s\",\n  \"mode\": \"%s\",\n  \"connections\": %u,\n  \"seconds\": %.3f,\n  \"rate\": %.1f,\n",
+           run.endpoint, (run.record != NULL) ? "replay" : (run.rate > 0) ? "open" : "closed", run.connections, seconds, run.rate);
+    if (run.record != NULL) {
+        printf("  \"trace\": \"%s\",\n  \"speed\": %.3f,\n  \"requests\": %zu,\n", run.trace, run.speed, run.requests);
+    } else {
+        printf("  \"devices\": %u,\n  \"zipf\": %.3f,\n  \"signatures\": %u,\n", run.devices, run.zipf, run.signatures);
+    }
+    printf("  \"sent\": %llu,\n  \"completed\": %llu,\n  \"busy\": %llu,\n  \"errors\": %llu,\n  \"lost\": %llu,\n",
+           (unsigned long long)sent, (unsigned long long)completed, (unsigned long long)busy, (unsigned long long)errors, (unsigned long long)lost);
+    printf("  \"requestsPerSecond\": %.1f,\n  \"signaturesPerSecond\": %.1f,\n", completed/seconds, signatures/seconds);
+    ESEM_Loadgen_Print_Hist("latencyUs", latency, false);
+    ESEM_Loadgen_Print_Hist("serviceUs", service, true);
+    printf("}\n");
+
+    for (c = 0; c < run.connections; c++) {
+        free(conn[c]);
+    }
+    free(conn);
+    free(latency);
+    free(service);
+    free(run.cdf);
+    free(run.record);
+    free(run.first);
+    return 0;
+}
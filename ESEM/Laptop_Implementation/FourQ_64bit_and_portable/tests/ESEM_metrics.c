@@ -0,0 +1,189 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: server metrics and the stats socket exposing them in Prometheus text format
+************************************************************************************/
+
+#include "ESEM.h"
+#include "zmq.h"
+#include <stdarg.h>
+
+
+struct esem_stats {
+    esem_server_t *server;
+    void *context;
+    void *socket;
+    pthread_t thread;
+};
+
+
+void ESEM_Metrics_Init(esem_metrics_t *metrics)
+{
+    unsigned int j;
+    esem_hist_t *hist[4] = {&metrics->latencyUs, &metrics->batchSize, &metrics->aggregationCycles, &metrics->normalizationCycles};
+
+    atomic_init(&metrics->commitments, 0);
+    atomic_init(&metrics->signatures, 0);
+    atomic_init(&metrics->batches, 0);
+    atomic_init(&metrics->dropped, 0);
+    atomic_init(&metrics->queueDepth, 0);
+    for (j = 0; j < ESEM_L; j++) {
+        atomic_init(&metrics->partyCycles[j], 0);
+        atomic_init(&metrics->partyCommitments[j], 0);
+    }
+    for (j = 0; j < 4; j++) {
+        memset(hist[j], 0, sizeof(esem_hist_t));
+    }
+}
+
+
+void ESEM_Hist_Add(esem_hist_t *hist, uint64_t value)
+{
+    unsigned int b = (value == 0) ? 0 : 64 - __builtin_clzll(value);
+
+    if (b >= ESEM_HIST_BUCKETS) {
+        b = ESEM_HIST_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&hist->bucket[b], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+}
+
+
+static void ESEM_Metrics_Print(char *buf, size_t size, size_t *len, const char *format, ...)
+{ // Appends to buf, dropping what does not fit
+
+    va_list args;
+    int n;
+
+    if (*len >= size) {
+        return;
+    }
+    va_start(args, format);
+    n = vsnprintf(buf + *len, size - *len, format, args);
+    va_end(args);
+    *len = (n < 0) ? size : (*len + n < size) ? *len + n : size;
+}
+
+
+static void ESEM_Metrics_Counter(char *buf, size_t size, size_t *len, const char *name, const char *help, const char *type, unsigned long value)
+{
+    ESEM_Metrics_Print(buf, size, len, "# HELP %s %s\n# TYPE %s %s\n%s %lu\n", name, help, name, type, name, value);
+}
+
+
+static void ESEM_Metrics_Hist(char *buf, size_t size, size_t *len, const char *name, const char *help, esem_hist_t *hist)
+{ // Cumulative buckets up to the highest one used. The count is the sum of the buckets, so that it matches them
+
+    unsigned long counts[ESEM_HIST_BUCKETS], total = 0;
+    unsigned int b, last = 0;
+
+    for (b = 0; b < ESEM_HIST_BUCKETS; b++) {
+        counts[b] = atomic_load_explicit(&hist->bucket[b], memory_order_relaxed);
+        if (counts[b] != 0) {
+            last = b;
+        }
+    }
+    ESEM_Metrics_Print(buf, size, len, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (b = 0; b <= last && b < ESEM_HIST_BUCKETS - 1; b++) {                 // The last bucket is open-ended
+        total += counts[b];
+        ESEM_Metrics_Print(buf, size, len, "%s_bucket{le=\"%llu\"} %lu\n", name, (1ULL << b) - 1, total);
+    }
+    for (; b < ESEM_HIST_BUCKETS; b++) {
+        total += counts[b];
+    }
+    ESEM_Metrics_Print(buf, size, len, "%s_bucket{le=\"+Inf\"} %lu\n%s_sum %lu\n%s_count %lu\n", name, total, name,
+                       atomic_load_explicit(&hist->sum, memory_order_relaxed), name, total);
+}
+
+
+size_t ESEM_Metrics_Format(esem_server_t *server, char *buf, size_t size)
+{
+    esem_metrics_t *metrics = &server->metrics;
+    uint64_t hits, misses;
+    size_t len = 0;
+    unsigned int j;
+
+    ESEM_Metrics_Counter(buf, size, &len, "esem_requests_total", "Requests answered.", "counter", atomic_load(&server->requests));
+    ESEM_Metrics_Counter(buf, size, &len, "esem_busy_total", "Requests answered busy.", "counter", atomic_load(&server->busy));
+    ESEM_Metrics_Counter(buf, size, &len, "esem_signatures_total", "Signatures answered, one per entry of a batched request.", "counter", atomic_load(&metrics->signatures));
+    ESEM_Metrics_Counter(buf, size, &len, "esem_commitments_total", "Partial commitments computed.", "counter", atomic_load(&metrics->commitments));
+    ESEM_Metrics_Counter(buf, size, &len, "esem_batches_total", "Batches of requests served.", "counter", atomic_load(&metrics->batches));
+    ESEM_Metrics_Counter(buf, size, &len, "esem_dropped_total", "Requests dropped unanswered, their routing envelope being too deep.", "counter", atomic_load(&metrics->dropped));
+    ESEM_Metrics_Counter(buf, size, &len, "esem_queue_depth", "Requests admitted and not answered yet.", "gauge", atomic_load(&metrics->queueDepth));
+    if (server->cache != NULL) {
+        ESEM_Cache_Stats(server->cache, &hits, &misses);
+        ESEM_Metrics_Counter(buf, size, &len, "esem_cache_hits_total", "Commitment cache hits.", "counter", (unsigned long)hits);
+        ESEM_Metrics_Counter(buf, size, &len, "esem_cache_misses_total", "Commitment cache misses.", "counter", (unsigned long)misses);
+    }
+    ESEM_Metrics_Print(buf, size, &len, "# HELP esem_party_cycles_total Aggregation cycles spent per party.\n# TYPE esem_party_cycles_total counter\n");
+    for (j = 0; j < ESEM_L; j++) {
+        ESEM_Metrics_Print(buf, size, &len, "esem_party_cycles_total{party=\"%u\"} %lu\n", j + 1, atomic_load(&metrics->partyCycles[j]));
+    }
+    ESEM_Metrics_Print(buf, size, &len, "# HELP esem_party_commitments_total Partial commitments computed per party.\n# TYPE esem_party_commitments_total counter\n");
+    for (j = 0; j < ESEM_L; j++) {
+        ESEM_Metrics_Print(buf, size, &len, "esem_party_commitments_total{party=\"%u\"} %lu\n", j + 1, atomic_load(&metrics->partyCommitments[j]));
+    }
+    ESEM_Metrics_Hist(buf, size, &len, "esem_request_latency_us", "Time from the arrival of a request to its reply, in microseconds.", &metrics->latencyUs);
+    ESEM_Metrics_Hist(buf, size, &len, "esem_batch_size", "Requests per batch.", &metrics->batchSize);
+    ESEM_Metrics_Hist(buf, size, &len, "esem_aggregation_cycles", "Cycles per computed partial commitment.", &metrics->aggregationCycles);
+    ESEM_Metrics_Hist(buf, size, &len, "esem_normalization_cycles", "Cycles of the batched normalization, per batch.", &metrics->normalizationCycles);
+    return len;
+}
+
+
+static void *ESEM_Stats_Thread(void *arg)
+{ // Answers until the context is shut down. Runs apart from the broker and workers, so scrapes never delay requests.
+  // An ESEM_TRACE_REQUEST is answered with a trace snapshot, empty if the server was built without ESEM_TRACE
+
+    esem_stats_t *stats = (esem_stats_t*)arg;
+    char *reply = malloc(ESEM_STATS_BYTES);
+    unsigned char request[16], *snapshot;
+    size_t len;
+    int rc;
+
+    while (reply != NULL && (rc = zmq_recv(stats->socket, request, sizeof(request), 0)) != -1) {
+        if (rc == (int)strlen(ESEM_TRACE_REQUEST) && memcmp(request, ESEM_TRACE_REQUEST, rc) == 0) {
+            snapshot = (ESEM_TRACE) ? ESEM_Trace_Snapshot(&len) : NULL;
+            zmq_send(stats->socket, snapshot, (snapshot != NULL) ? len : 0, 0);
+            free(snapshot);
+            continue;
+        }
+        len = ESEM_Metrics_Format(stats->server, reply, ESEM_STATS_BYTES);
+        zmq_send(stats->socket, reply, len, 0);
+    }
+    free(reply);
+    zmq_close(stats->socket);
+    return NULL;
+}
+
+
+esem_stats_t* ESEM_Stats_Start(esem_server_t *server, const char *endpoint)
+{
+    esem_stats_t *stats = malloc(sizeof(esem_stats_t));
+
+    if (stats == NULL) {
+        return NULL;
+    }
+    stats->server = server;
+    stats->context = zmq_ctx_new();
+    stats->socket = zmq_socket(stats->context, ZMQ_REP);
+    if (zmq_bind(stats->socket, endpoint) != 0 || pthread_create(&stats->thread, NULL, ESEM_Stats_Thread, stats) != 0) {
+        zmq_close(stats->socket);
+        zmq_ctx_term(stats->context);
+        free(stats);
+        return NULL;
+    }
+    return stats;
+}
+
+
+void ESEM_Stats_Stop(esem_stats_t *stats)
+{
+    if (stats == NULL) {
+        return;
+    }
+    zmq_ctx_shutdown(stats->context);                  // Unblocks the thread, which closes its socket
+    pthread_join(stats->thread, NULL);
+    zmq_ctx_term(stats->context);
+    free(stats);
+}
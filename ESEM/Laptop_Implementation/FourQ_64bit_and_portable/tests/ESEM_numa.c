@@ -0,0 +1,92 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: NUMA topology, thread pinning and page placement queries for the server
+************************************************************************************/
+
+#define _GNU_SOURCE
+#include "ESEM.h"
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+
+// Only sysfs and raw system calls are used, so the server does not depend on libnuma
+
+static unsigned int ESEM_Numa_Cpulist(const char *path, int cpu[ESEM_NUMA_MAX_CPUS])
+{ // Parses a sysfs cpu list such as "0-3,8-11", returns the number of cpus read
+
+    FILE *f = fopen(path, "r");
+    unsigned int n = 0;
+    int first, last, c;
+
+    if (f == NULL) {
+        return 0;
+    }
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+        c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%d", &last) != 1) {
+                break;
+            }
+            c = fgetc(f);
+        }
+        for (; first <= last && n < ESEM_NUMA_MAX_CPUS; first++) {
+            cpu[n++] = first;
+        }
+        if (c != ',') {
+            break;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+
+unsigned int ESEM_Numa_Discover(esem_node_t *nodes, unsigned int maxNodes)
+{ // Fills in the id and cpus of the NUMA nodes that have cpus, returns their number. Returns a single node with id -1
+  // and no cpus if the topology is unknown
+
+    char path[64];
+    unsigned int n = 0;
+    int id;
+
+    for (id = 0; id < ESEM_NUMA_MAX_NODE_ID && n < maxNodes; id++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+        nodes[n].ncpus = ESEM_Numa_Cpulist(path, nodes[n].cpu);
+        if (nodes[n].ncpus > 0) {
+            nodes[n++].id = id;
+        }
+    }
+    if (n == 0) {
+        nodes[0].id = -1;
+        nodes[0].ncpus = 0;
+        n = 1;
+    }
+    return n;
+}
+
+
+bool ESEM_Numa_Pin(int cpu)
+{ // Pins the calling thread to one cpu
+
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+
+int ESEM_Numa_Node_Of(const void *addr)
+{ // NUMA node of the page holding addr, which must already be faulted in, or -1 if it cannot be determined
+
+    int node = -1;
+
+    if (syscall(SYS_get_mempolicy, &node, NULL, 0, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+        return -1;
+    }
+    return node;
+}
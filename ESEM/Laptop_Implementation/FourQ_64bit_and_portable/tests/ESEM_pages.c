@@ -0,0 +1,155 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: allocation of the public tables on huge pages
+************************************************************************************/
+
+#define _GNU_SOURCE
+#include "ESEM.h"
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+
+// A commitment reads BPV_V scattered entries of each of the ESEM_L tables, so with large tables (or many of them)
+// nearly every read touches a different page. Backing the tables with 2 MB pages lets a handful of TLB entries
+// cover them. Tables are mapped with a small header in front, recording how they were obtained.
+
+#define ESEM_HUGE_PAGE_BYTES  (2*1024*1024)
+#define ESEM_TABLE_HEADER     64          // Keeps the table cache-line aligned
+
+typedef struct {
+    size_t mapLen;
+    unsigned int pages;                    // ESEM_PAGES_* actually backing the table
+} esem_table_header_t;
+
+
+static void* ESEM_Table_Map(size_t mapLen, unsigned int pages)
+{ // Maps mapLen bytes with the given page size, aligned to a huge page for ESEM_PAGES_TRANSPARENT. NULL on failure
+
+    unsigned char *map, *aligned;
+    size_t lead;
+
+    if (pages == ESEM_PAGES_HUGETLB) {
+        map = mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        return (map == MAP_FAILED) ? NULL : map;
+    }
+    if (pages == ESEM_PAGES_SMALL) {
+        map = mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (map == MAP_FAILED) {
+            return NULL;
+        }
+        madvise(map, mapLen, MADV_NOHUGEPAGE);             // Also with transparent huge pages set to "always"
+        return map;
+    }
+
+    // Transparent huge pages only back huge-page aligned ranges: over-allocate and trim
+    map = mmap(NULL, mapLen + ESEM_HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    aligned = (unsigned char*)(((uintptr_t)map + ESEM_HUGE_PAGE_BYTES - 1) & ~(uintptr_t)(ESEM_HUGE_PAGE_BYTES - 1));
+    lead = (size_t)(aligned - map);
+    if (lead != 0) {
+        munmap(map, lead);
+    }
+    munmap(aligned + mapLen, ESEM_HUGE_PAGE_BYTES - lead);
+    if (madvise(aligned, mapLen, MADV_HUGEPAGE) != 0) {
+        munmap(aligned, mapLen);
+        return NULL;
+    }
+    return aligned;
+}
+
+
+void* ESEM_Table_Alloc_Pages(size_t bytes, unsigned int pages)
+{ // Table of the given size on the requested pages, falling back to smaller ones: ESEM_PAGES_HUGETLB needs pages
+  // reserved in /proc/sys/vm/nr_hugepages, ESEM_PAGES_TRANSPARENT needs transparent huge pages not to be "never".
+  // The memory is zeroed and released with ESEM_Table_Free. Returns NULL on failure.
+
+    size_t mapLen, pageBytes;
+    esem_table_header_t *header = NULL;
+
+    for (; header == NULL; pages--) {
+        pageBytes = (pages == ESEM_PAGES_SMALL) ? (size_t)sysconf(_SC_PAGESIZE) : ESEM_HUGE_PAGE_BYTES;
+        mapLen = (ESEM_TABLE_HEADER + bytes + pageBytes - 1) & ~(pageBytes - 1);
+        header = ESEM_Table_Map(mapLen, pages);
+        if (header != NULL) {
+            header->mapLen = mapLen;
+            header->pages = pages;
+        }
+        if (pages == ESEM_PAGES_SMALL) {
+            break;
+        }
+    }
+    return (header == NULL) ? NULL : (unsigned char*)header + ESEM_TABLE_HEADER;
+}
+
+
+void* ESEM_Table_Alloc(size_t bytes)
+{ // Table on the pages selected by ESEM_TABLE_PAGES. Tables much smaller than a huge page, such as the BPV_N = 128
+  // tables, get small pages: they span few pages anyway and a huge page each would mostly be wasted
+
+    return ESEM_Table_Alloc_Pages(bytes, (bytes >= ESEM_HUGE_PAGE_BYTES/2) ? ESEM_TABLE_PAGES : ESEM_PAGES_SMALL);
+}
+
+
+unsigned int ESEM_Table_Pages(void *table)
+{ // ESEM_PAGES_* backing a table. With ESEM_PAGES_TRANSPARENT the kernel may still have used small pages
+
+    return ((esem_table_header_t*)((unsigned char*)table - ESEM_TABLE_HEADER))->pages;
+}
+
+
+void ESEM_Table_Free(void *table)
+{
+    esem_table_header_t *header;
+
+    if (table == NULL) {
+        return;
+    }
+    header = (esem_table_header_t*)((unsigned char*)table - ESEM_TABLE_HEADER);
+    munmap(header, header->mapLen);
+}
+
+
+int ESEM_Tlb_Open(void)
+{ // Starts counting the data TLB read misses of the calling thread, for the benchmarks. Returns -1 if the kernel
+  // or the cpu does not provide the event (e.g. perf_event_paranoid too high, or inside most virtual machines)
+
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return fd;
+}
+
+
+int64_t ESEM_Tlb_Close(int fd)
+{ // Misses counted since ESEM_Tlb_Open, or -1
+
+    uint64_t count;
+
+    if (fd < 0) {
+        return -1;
+    }
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        count = (uint64_t)-1;
+    }
+    close(fd);
+    return (int64_t)count;
+}
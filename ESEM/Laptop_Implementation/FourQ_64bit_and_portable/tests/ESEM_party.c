@@ -0,0 +1,188 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: thread pool computing the partial commitments of one request in parallel
+************************************************************************************/
+
+#include "ESEM.h"
+#include "test_extras.h"
+
+
+// A worker hands the ESEM_L partial commitments of a latency-sensitive request to the pool and helps computing them
+// until all are done, so the request takes about one aggregation instead of ESEM_L. The helpers are shared by all
+// workers. A waiting worker computes whatever is queued itself, so no job ever waits for a thread to be free.
+
+#define ESEM_PARTY_QUEUE      (ESEM_MAX_BATCH*ESEM_L)
+
+struct esem_party_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;                   // Signalled when jobs are queued or the pool stops
+    pthread_cond_t done;                   // Broadcast when a job is completed
+    esem_party_job_t *queue[ESEM_PARTY_QUEUE];
+    unsigned int head, count;
+    bool stop;
+    unsigned int nthreads;
+    pthread_t *threads;
+};
+
+
+static void ESEM_Party_Run(esem_party_job_t *job)
+{
+    int64_t start = cpucycles();
+
+    ESEM_TRACE_BEGIN(ESEM_EV_PARTY, 0);
+    if (job->block != 0) {
+        ESEM_Commit_Subsets(job->table, job->block, job->tempKey, job->randValue, job->R);
+    } else {
+        ESEM_Commit(job->table, job->tempKey, job->randValue, job->R);
+    }
+    job->cycles = cpucycles() - start;
+    ESEM_TRACE_END(ESEM_EV_PARTY, 0);
+}
+
+
+static esem_party_job_t* ESEM_Party_Pop(esem_party_pool_t *pool)
+{ // Oldest queued job, or NULL. Called with the lock held
+
+    esem_party_job_t *job;
+
+    if (pool->count == 0) {
+        return NULL;
+    }
+    job = pool->queue[pool->head];
+    pool->head = (pool->head + 1) % ESEM_PARTY_QUEUE;
+    pool->count--;
+    return job;
+}
+
+
+static void ESEM_Party_Complete(esem_party_pool_t *pool, esem_party_job_t *job)
+{ // Runs a popped job. Called with the lock held, which is released meanwhile
+
+    pthread_mutex_unlock(&pool->lock);
+    ESEM_Party_Run(job);
+    pthread_mutex_lock(&pool->lock);
+    if (--*job->remaining == 0) {
+        pthread_cond_broadcast(&pool->done);
+    }
+}
+
+
+static void *ESEM_Party_Thread(void *arg)
+{
+    esem_party_pool_t *pool = arg;
+    esem_party_job_t *job;
+
+    ESEM_TRACE_THREAD("party", -1);
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        job = ESEM_Party_Pop(pool);
+        if (job == NULL) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+            continue;
+        }
+        ESEM_Party_Complete(pool, job);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+
+esem_party_pool_t* ESEM_Party_New(unsigned int nthreads)
+{
+    esem_party_pool_t *pool;
+
+    if (nthreads == 0) {
+        return NULL;
+    }
+    pool = calloc(1, sizeof(esem_party_pool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = malloc(nthreads*sizeof(pthread_t));
+    if (pool->threads == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (pool->nthreads = 0; pool->nthreads < nthreads; pool->nthreads++) {
+        if (pthread_create(&pool->threads[pool->nthreads], NULL, ESEM_Party_Thread, pool) != 0) {
+            ESEM_Party_Free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+
+void ESEM_Party_Free(esem_party_pool_t *pool)
+{ // Stops the threads, which must not have jobs left
+
+    unsigned int t;
+
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (t = 0; t < pool->nthreads; t++) {
+        pthread_join(pool->threads[t], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
+
+
+void ESEM_Party_Post(esem_party_pool_t *pool, esem_party_job_t *jobs, unsigned int n)
+{
+    unsigned int i, queued;
+
+    if (n == 0) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    *jobs[0].remaining += n;
+    for (queued = 0; queued < n && pool->count < ESEM_PARTY_QUEUE; queued++) {
+        pool->queue[(pool->head + pool->count++) % ESEM_PARTY_QUEUE] = &jobs[queued];
+    }
+    if (queued == 1) {
+        pthread_cond_signal(&pool->work);
+    } else if (queued > 1) {
+        pthread_cond_broadcast(&pool->work);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = queued; i < n; i++) {                                       // Queue full: no helper would get to them sooner
+        ESEM_Party_Run(&jobs[i]);
+    }
+    if (queued < n) {
+        pthread_mutex_lock(&pool->lock);
+        *jobs[0].remaining -= n - queued;
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+
+void ESEM_Party_Wait(esem_party_pool_t *pool, unsigned int *remaining)
+{ // The caller computes queued jobs, its own or other workers', rather than sleeping while any are left
+
+    esem_party_job_t *job;
+
+    pthread_mutex_lock(&pool->lock);
+    while (*remaining != 0) {
+        job = ESEM_Party_Pop(pool);
+        if (job == NULL) {
+            pthread_cond_wait(&pool->done, &pool->lock);
+            continue;
+        }
+        ESEM_Party_Complete(pool, job);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
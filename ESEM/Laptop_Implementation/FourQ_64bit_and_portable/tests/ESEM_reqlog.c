@@ -0,0 +1,148 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: request log of the commitment server, to be replayed by ESEM_loadgen --replay
+************************************************************************************/
+
+#include "ESEM.h"
+
+
+// The log keeps what a replay needs to reproduce the load: when each request arrived, and for each of its signatures
+// the device, the mask byte and x. Records go through a stdio buffer, flushed when it fills and every
+// ESEM_REQUEST_LOG_FLUSH_US by a thread of the log, so that logging costs no system call per request and a server
+// killed while idle leaves a complete log. The stdio lock of the file keeps the flushes apart from the writes.
+
+#define ESEM_REQUEST_LOG_BUFFER_BYTES (1 << 20)
+
+struct esem_reqlog {
+    FILE *file;
+    char *buffer;
+    bool failed;                           // A write failed, the log is incomplete
+    bool closing;
+    pthread_t flusher;
+    pthread_mutex_t lock;                  // Protects closing and failed
+    pthread_cond_t closed;
+};
+
+
+static void *ESEM_Reqlog_Flusher(void *arg)
+{
+    esem_reqlog_t *log = (esem_reqlog_t*)arg;
+    struct timespec until;
+    bool failed;
+
+    pthread_mutex_lock(&log->lock);
+    while (!log->closing) {
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += ESEM_REQUEST_LOG_FLUSH_US/1000000;
+        until.tv_nsec += (ESEM_REQUEST_LOG_FLUSH_US%1000000)*1000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        if (pthread_cond_timedwait(&log->closed, &log->lock, &until) == 0) {
+            continue;
+        }
+        pthread_mutex_unlock(&log->lock);
+        failed = fflush(log->file) != 0;
+        pthread_mutex_lock(&log->lock);
+        log->failed |= failed;
+    }
+    pthread_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+
+esem_reqlog_t* ESEM_Reqlog_Open(const char *path)
+{
+    esem_reqlog_t *log = malloc(sizeof(esem_reqlog_t));
+    struct timespec ts;
+    uint64_t clock[2];
+
+    if (log == NULL) {
+        return NULL;
+    }
+    log->closing = false;
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->closed, NULL);
+    log->buffer = malloc(ESEM_REQUEST_LOG_BUFFER_BYTES);
+    log->file = fopen(path, "wb");
+    if (log->buffer == NULL || log->file == NULL) {
+        if (log->file != NULL) {
+            fclose(log->file);
+        }
+        free(log->buffer);
+        free(log);
+        return NULL;
+    }
+    setvbuf(log->file, log->buffer, _IOFBF, ESEM_REQUEST_LOG_BUFFER_BYTES);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    clock[0] = (uint64_t)ts.tv_sec*1000000 + (uint64_t)ts.tv_nsec/1000;
+    clock[1] = (uint64_t)ESEM_Now_us();
+    log->failed = fwrite(ESEM_REQUEST_LOG_MAGIC, 1, 8, log->file) != 8 || fwrite(clock, sizeof(uint64_t), 2, log->file) != 2 ||
+                  fflush(log->file) != 0;
+    if (log->failed || pthread_create(&log->flusher, NULL, ESEM_Reqlog_Flusher, log) != 0) {
+        fclose(log->file);
+        free(log->buffer);
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+
+void ESEM_Reqlog_Request(esem_reqlog_t *log, long arrivalUs, unsigned char *request, int requestLen)
+{
+    esem_reqlog_record_t record[ESEM_MAX_SIGNATURES];
+    unsigned char *entry[ESEM_MAX_SIGNATURES];
+    int entryLen[ESEM_MAX_SIGNATURES];
+    unsigned int e, n, count;
+    uint32_t device;
+
+    if (log == NULL) {
+        return;
+    }
+    count = ESEM_Entries(request, requestLen, entry, entryLen);
+    for (e = 0, n = 0; e < count; e++) {
+        if (ESEM_Parties(entry[e], entryLen[e]) == 0) {                  // Malformed, nothing to replay
+            continue;
+        }
+        memset(&record[n], 0, sizeof(esem_reqlog_record_t));
+        record[n].us = (uint64_t)arrivalUs;
+        record[n].device = ESEM_Device(entry[e], entryLen[e], &device) ? device : ESEM_DEVICE_BUILTIN;
+        record[n].mask = entry[e][ESEM_X_BYTES];
+        record[n].batched = entry[0] != request;
+        memcpy(record[n].x, entry[e], ESEM_X_BYTES);
+        n++;
+    }
+    if (n == 0) {
+        return;
+    }
+    record[0].entries = (uint8_t)n;
+    if (fwrite(record, sizeof(esem_reqlog_record_t), n, log->file) != n) {
+        pthread_mutex_lock(&log->lock);
+        log->failed = true;
+        pthread_mutex_unlock(&log->lock);
+    }
+}
+
+
+bool ESEM_Reqlog_Close(esem_reqlog_t *log)
+{
+    bool ok;
+
+    if (log == NULL) {
+        return true;
+    }
+    pthread_mutex_lock(&log->lock);
+    log->closing = true;
+    pthread_cond_signal(&log->closed);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->flusher, NULL);
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->closed);
+    ok = fclose(log->file) == 0 && !log->failed;
+    free(log->buffer);
+    free(log);
+    return ok;
+}
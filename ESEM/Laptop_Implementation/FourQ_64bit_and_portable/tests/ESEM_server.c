@@ -0,0 +1,1389 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: commitment server computing the partial commitments of the ESEM parties
+************************************************************************************/
+
+#include "ESEM.h"
+#include "blake2.h"
+#include "zmq.h"
+#include "test_extras.h"
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+typedef struct {
+    zmq_msg_t route[ESEM_MAX_ROUTE];       // Routing envelope, echoed back in front of the reply
+    unsigned int nroute;
+    unsigned char request[ESEM_MAX_REQUEST_BYTES];
+    int requestLen;
+    long arrivalUs;                        // Time the server received the request
+} esem_request_t;
+
+
+typedef struct {
+    atomic_uint refs;                      // One for the owning worker, plus one per frame ZMQ has not released yet
+    bool copied;                           // Frames are copied into their messages, ZMQ never holds the arena
+    unsigned char frames[];
+} esem_arena_t;
+
+
+long ESEM_Now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+
+static void ESEM_Indices(unsigned char tempKey[32], unsigned char randValue[16], uint32_t index[BPV_V])
+{ // The BPV_V table indices selected by blake2b(x, tempKey)
+    uint64_t i;
+
+    ESEM_TRACE_BEGIN(ESEM_EV_INDICES, 0);
+#if defined(HIGH_SPEED)
+    unsigned char hashOutput[40] = {0};
+
+    blake2b(hashOutput, randValue, tempKey, 40, 16, 32);
+    for (i = 0; i < BPV_V; ++i) {
+        index[i] = hashOutput[i]/2;
+    }
+#else
+    unsigned char hashOutput[36] = {0};
+
+    blake2b(hashOutput, randValue, tempKey, 36, 16, 32);
+    for (i = 0; i < BPV_V; ++i) {
+        index[i] = hashOutput[2*i] + ((hashOutput[2*i+1]/64) * 256);
+    }
+#endif
+    ESEM_TRACE_END(ESEM_EV_INDICES, 0);
+}
+
+
+void ESEM_Commit(point_precomp_t *publicTable, unsigned char tempKey[32], unsigned char randValue[16], point_extproj_t R)
+{ // R = sum of the BPV_V public values Y[i] selected by blake2b(x, tempKey), in representation (X,Y,Z,Ta,Tb)
+    uint64_t i;
+    uint32_t index[BPV_V];
+
+    ESEM_Indices(tempKey, randValue, index);
+
+    ESEM_TRACE_BEGIN(ESEM_EV_AGGREGATE, 1);
+    R5_to_R1(publicTable[index[0]], R);
+    for (i = 1; i < BPV_V; ++i) {
+        eccmadd_ni(publicTable[index[i]], R);          // Add the R[i]'s and compute the final R
+    }
+    ESEM_TRACE_END(ESEM_EV_AGGREGATE, 1);
+}
+
+
+void ESEM_Commit_x4(point_precomp_t *publicTable[4], unsigned char *tempKey[4], unsigned char *randValue[4], point_extproj_t R[4])
+{ // Four independent ESEM_Commit's, R[k] for (publicTable[k], tempKey[k], randValue[k]), aggregated together by eccmadd_sum_x4
+    unsigned int i, k;
+    uint32_t index[BPV_V];
+    point_precomp *lane[4][BPV_V], **Q[4];
+
+    for (k = 0; k < 4; k++) {
+        ESEM_Indices(tempKey[k], randValue[k], index);
+        ESEM_TRACE_BEGIN(ESEM_EV_GATHER, 1);
+        for (i = 0; i < BPV_V; ++i) {
+            lane[k][i] = publicTable[k][index[i]];
+        }
+        Q[k] = lane[k];
+        ESEM_TRACE_END(ESEM_EV_GATHER, 1);
+    }
+    ESEM_TRACE_BEGIN(ESEM_EV_AGGREGATE, 4);
+    eccmadd_sum_x4(Q, BPV_V, R);
+    ESEM_TRACE_END(ESEM_EV_AGGREGATE, 4);
+}
+
+
+void ESEM_Commit_Interleaved(point_precomp_t *publicTable[], unsigned char *tempKey[], unsigned char *randValue[], unsigned int count, point_extproj_t R[])
+{ // count <= MADD_MAX_LANES independent ESEM_Commit's, e.g. the ESEM_L parties of one request, aggregated in lock-step
+    unsigned int i, k;
+    uint32_t index[BPV_V];
+    point_precomp *lane[MADD_MAX_LANES][BPV_V], **Q[MADD_MAX_LANES];
+
+    for (k = 0; k < count; k++) {
+        ESEM_Indices(tempKey[k], randValue[k], index);
+        ESEM_TRACE_BEGIN(ESEM_EV_GATHER, 1);
+        for (i = 0; i < BPV_V; ++i) {
+            lane[k][i] = publicTable[k][index[i]];
+        }
+        Q[k] = lane[k];
+        ESEM_TRACE_END(ESEM_EV_GATHER, 1);
+    }
+    ESEM_TRACE_BEGIN(ESEM_EV_AGGREGATE, count);
+    eccmadd_sum_interleaved(Q, count, BPV_V, R);
+    ESEM_TRACE_END(ESEM_EV_AGGREGATE, count);
+}
+
+
+ECCRYPTO_STATUS ESEM_Commit_Affine_Batch(point_precomp_t *publicTable[], unsigned char *tempKey[], unsigned char *randValue[], unsigned int count, point_t *R)
+{ // count independent partial commitments, summed in affine coordinates by ecc_sum_affine_batch, so no eccnorm is needed
+    unsigned int i, k;
+    uint32_t index[BPV_V];
+    point_precomp **lane, ***Q, *work;
+    f2elm_t *scratch;
+    ECCRYPTO_STATUS Status = ECCRYPTO_SUCCESS;
+
+    lane = malloc((size_t)count*BPV_V*sizeof(point_precomp*));
+    Q = malloc((size_t)count*sizeof(point_precomp**));
+    work = malloc((size_t)count*((BPV_V + 1)/2)*sizeof(point_precomp));
+    scratch = malloc((size_t)3*count*(BPV_V/2)*sizeof(f2elm_t));
+    if (lane == NULL || Q == NULL || work == NULL || scratch == NULL) {
+        Status = ECCRYPTO_ERROR_NO_MEMORY;
+        goto cleanup;
+    }
+    for (k = 0; k < count; k++) {
+        ESEM_Indices(tempKey[k], randValue[k], index);
+        ESEM_TRACE_BEGIN(ESEM_EV_GATHER, 1);
+        Q[k] = lane + (size_t)k*BPV_V;
+        for (i = 0; i < BPV_V; ++i) {
+            Q[k][i] = publicTable[k][index[i]];
+        }
+        ESEM_TRACE_END(ESEM_EV_GATHER, 1);
+    }
+    ESEM_TRACE_BEGIN(ESEM_EV_AGGREGATE, count);
+    ecc_sum_affine_batch(Q, count, BPV_V, R, work, scratch);
+    ESEM_TRACE_END(ESEM_EV_AGGREGATE, count);
+
+cleanup:
+    free(lane);
+    free(Q);
+    free(work);
+    free(scratch);
+    return Status;
+}
+
+
+point_precomp_t* ESEM_Precompute_Subsets(point_precomp_t *publicTable, unsigned int block)
+{ // Splits the BPV_N table indices into blocks of "block" consecutive indices and stores, for every block, the sums of
+  // all its 2^block-1 non-empty subsets in (x+y,y-x,2dt) form. Entry (k, s) holds the sum for bit mask s of block k.
+  // Positions past BPV_N in the last block stand for the neutral point. Returns NULL on failure.
+
+    unsigned int k, s, low, nblocks, nsubsets = (1 << block) - 1;
+    point_precomp_t *subsetTable, neutral;
+    point_extproj_t *sums;
+    point_t *affine;
+    point_t O;
+
+    if (block == 0 || block > ESEM_SUBSET_MAX_BLOCK) {
+        return NULL;
+    }
+    nblocks = (BPV_N + block - 1)/block;
+    subsetTable = ESEM_Table_Alloc((size_t)nblocks*nsubsets*sizeof(point_precomp_t));
+    sums = malloc((nsubsets + 1)*sizeof(point_extproj_t));
+    affine = malloc((nsubsets + 1)*sizeof(point_t));
+    if (subsetTable == NULL || sums == NULL || affine == NULL) {
+        ESEM_Table_Free(subsetTable);
+        subsetTable = NULL;
+        goto cleanup;
+    }
+    memset(O, 0, sizeof(point_t));
+    O->y[0][0] = 1;
+    point_setup_precomp(O, neutral);
+
+    for (k = 0; k < nblocks; k++) {
+        for (s = 1; s <= nsubsets; s++) {                              // sum(s) = sum(s without its lowest bit) + Y[lowest bit]
+            for (low = 0; !(s & (1 << low)); low++);
+            if (s == (1U << low)) {
+                R5_to_R1((k*block + low < BPV_N) ? publicTable[k*block + low] : neutral, sums[s]);
+            } else {
+                memcpy(sums[s], sums[s ^ (1 << low)], sizeof(point_extproj_t));
+                eccmadd_ni((k*block + low < BPV_N) ? publicTable[k*block + low] : neutral, sums[s]);
+            }
+        }
+        eccnorm_batch(sums + 1, affine + 1, nsubsets);
+        for (s = 1; s <= nsubsets; s++) {
+            point_setup_precomp(affine[s], subsetTable[(size_t)k*nsubsets + s - 1]);
+        }
+    }
+
+cleanup:
+    free(sums);
+    free(affine);
+
+    return subsetTable;
+}
+
+
+unsigned int ESEM_Commit_Subsets(point_precomp_t *subsetTable, unsigned int block, unsigned char tempKey[32], unsigned char randValue[16], point_extproj_t R)
+{ // Same R as ESEM_Commit, assembled from the subset sums of ESEM_Precompute_Subsets: one entry per block touched by
+  // the selected indices, plus one single-index entry for every repeated index. Returns the number of additions.
+
+    uint64_t i;
+    uint32_t index[BPV_V], repeated[BPV_V];
+    unsigned int k, bit, nrepeated = 0, nadd = 0, nsubsets = (1 << block) - 1;
+    unsigned int mask[BPV_N] = {0};
+    bool first = true;
+
+    ESEM_Indices(tempKey, randValue, index);
+
+    ESEM_TRACE_BEGIN(ESEM_EV_AGGREGATE, 1);
+    for (i = 0; i < BPV_V; ++i) {
+        k = index[i]/block;
+        bit = 1 << (index[i] % block);
+        if (mask[k] & bit) {
+            repeated[nrepeated++] = index[i];
+        } else {
+            mask[k] |= bit;
+        }
+    }
+    for (k = 0; k < (BPV_N + block - 1)/block; k++) {
+        if (mask[k] == 0) {
+            continue;
+        }
+        if (first) {
+            R5_to_R1(subsetTable[(size_t)k*nsubsets + mask[k] - 1], R);
+            first = false;
+        } else {
+            eccmadd_ni(subsetTable[(size_t)k*nsubsets + mask[k] - 1], R);
+            nadd++;
+        }
+    }
+    for (i = 0; i < nrepeated; ++i) {
+        k = repeated[i]/block;
+        eccmadd_ni(subsetTable[(size_t)k*nsubsets + (1 << (repeated[i] % block)) - 1], R);
+        nadd++;
+    }
+    ESEM_TRACE_END(ESEM_EV_AGGREGATE, 1);
+
+    return nadd;
+}
+
+
+unsigned int ESEM_Parties(unsigned char *request, int requestLen)
+{ // Returns the party mask selected by the request, or 0 if the request is malformed
+
+    unsigned int mask;
+
+    if (requestLen != ESEM_REQUEST_BYTES && requestLen != ESEM_DEVICE_REQUEST_BYTES) {
+        return 0;
+    }
+    mask = request[ESEM_X_BYTES];
+    if ((mask & ~(unsigned int)(ESEM_PARTY_ALL | ESEM_FLAGS | ESEM_FLAG_URGENT)) != 0) {
+        return 0;
+    }
+    return mask & ESEM_PARTY_ALL;
+}
+
+
+unsigned int ESEM_Flags(unsigned char *request, int requestLen)
+{ // Returns the response-format flags of the request, 0 if the request has no mask byte
+
+    if (requestLen != ESEM_REQUEST_BYTES && requestLen != ESEM_DEVICE_REQUEST_BYTES) {
+        return 0;
+    }
+    return request[ESEM_X_BYTES] & ESEM_FLAGS;
+}
+
+
+unsigned int ESEM_Class(unsigned char *request, int requestLen)
+{
+    if (requestLen != ESEM_REQUEST_BYTES && requestLen != ESEM_DEVICE_REQUEST_BYTES) {
+        return ESEM_CLASS_NORMAL;
+    }
+    return (request[ESEM_X_BYTES] & ESEM_FLAG_URGENT) ? ESEM_CLASS_URGENT : ESEM_CLASS_NORMAL;
+}
+
+
+bool ESEM_Device(unsigned char *request, int requestLen, uint32_t *device)
+{ // Reads the device ID following the mask byte, returns false if the request has none or names ESEM_DEVICE_BUILTIN
+
+    unsigned char *id = request + ESEM_REQUEST_BYTES;
+
+    if (requestLen != ESEM_DEVICE_REQUEST_BYTES) {
+        return false;
+    }
+    *device = (uint32_t)id[0] | ((uint32_t)id[1] << 8) | ((uint32_t)id[2] << 16) | ((uint32_t)id[3] << 24);
+    return *device != ESEM_DEVICE_BUILTIN;
+}
+
+
+unsigned int ESEM_Entries(unsigned char *request, int requestLen, unsigned char *entry[ESEM_MAX_SIGNATURES], int entryLen[ESEM_MAX_SIGNATURES])
+{ // Single requests, and malformed ones, are one entry. The lengths of batched requests never match a single request
+
+    unsigned int e, count;
+
+    count = (requestLen > ESEM_BATCH_HEADER_BYTES && request[0] == ESEM_BATCH_TAG) ? request[1] : 0;
+    if (count == 0 || count > ESEM_MAX_SIGNATURES || requestLen != ESEM_BATCH_BYTES((int)count)) {
+        entry[0] = request;
+        entryLen[0] = requestLen;
+        return 1;
+    }
+    for (e = 0; e < count; e++) {
+        entry[e] = request + ESEM_BATCH_BYTES(e);
+        entryLen[e] = ESEM_ENTRY_BYTES;
+    }
+    return count;
+}
+
+
+int ESEM_Batch_Request(unsigned char *request, unsigned char *x[], const unsigned char mask[], const uint32_t device[], unsigned int count)
+{
+    unsigned char *entry;
+    unsigned int e;
+
+    if (count == 0 || count > ESEM_MAX_SIGNATURES) {
+        return -1;
+    }
+    request[0] = ESEM_BATCH_TAG;
+    request[1] = (unsigned char)count;
+    for (e = 0; e < count; e++) {
+        entry = request + ESEM_BATCH_BYTES(e);
+        memcpy(entry, x[e], ESEM_X_BYTES);
+        entry[ESEM_X_BYTES] = mask[e];
+        entry[ESEM_REQUEST_BYTES] = (unsigned char)device[e];
+        entry[ESEM_REQUEST_BYTES+1] = (unsigned char)(device[e] >> 8);
+        entry[ESEM_REQUEST_BYTES+2] = (unsigned char)(device[e] >> 16);
+        entry[ESEM_REQUEST_BYTES+3] = (unsigned char)(device[e] >> 24);
+    }
+    return ESEM_BATCH_BYTES((int)count);
+}
+
+
+void ESEM_Encode_Projective(point_extproj_t R, unsigned char encoded[ESEM_PROJ_BYTES])
+{ // Encodes R as (X,Y,Z,T) with T = Ta*Tb, 32 bytes per fully reduced coordinate
+
+    f2elm_t c[4];
+    unsigned int i;
+
+    fp2copy1271(R->x, c[0]);
+    fp2copy1271(R->y, c[1]);
+    fp2copy1271(R->z, c[2]);
+    fp2mul1271(R->ta, R->tb, c[3]);
+    for (i = 0; i < 4; i++) {
+        mod1271(c[i][0]);
+        mod1271(c[i][1]);
+    }
+    memcpy(encoded, c, ESEM_PROJ_BYTES);
+}
+
+
+void ESEM_Encode_Compressed(unsigned char frame[ESEM_POINT_BYTES])
+{ // Replaces the affine (x,y) commitment in frame by its 32-byte encoding
+
+    point_t A;
+
+    memcpy(A, frame, ESEM_POINT_BYTES);
+    encode(A, frame);
+}
+
+
+bool ESEM_Decode_Commitment(unsigned char *frame, int frameLen, point_extproj_t R)
+{ // Decodes a compressed, affine (x,y) or projective (X,Y,Z,T) commitment into representation (X,Y,Z,Ta,Tb)
+
+    f2elm_t c[4];
+    point_t A;
+
+    if (frameLen == ESEM_COMPRESSED_BYTES) {
+        if (decode(frame, A) != ECCRYPTO_SUCCESS) {
+            return false;
+        }
+        point_setup(A, R);
+        return true;
+    }
+    if (frameLen == ESEM_POINT_BYTES) {
+        point_setup((point_affine*)frame, R);
+        return true;
+    }
+    if (frameLen != ESEM_PROJ_BYTES) {
+        return false;
+    }
+    memcpy(c, frame, ESEM_PROJ_BYTES);
+    fp2copy1271(c[0], R->x);
+    fp2copy1271(c[1], R->y);
+    fp2copy1271(c[2], R->z);
+    fp2copy1271(c[3], R->ta);
+    fp2zero1271(R->tb);
+    R->tb[0][0] = 1;                                    // T = Ta*Tb with Tb = 1
+    return true;
+}
+
+
+static int ESEM_Recv_Request(void *socket, esem_request_t *pending, int flags, bool stamped, esem_metrics_t *metrics)
+{ // Receives one request together with its routing envelope. Returns the payload length, or -1 if nothing was received.
+  // A stamped envelope starts with the arrival time added by ESEM_Broker, which is kept in front of the reply.
+  // Requests with more than ESEM_MAX_ROUTE routing frames are dropped, as a reply behind a cut envelope would go to
+  // the wrong peer, and the next request is received instead.
+
+    zmq_msg_t part;
+    int more, size = -1;
+    size_t moreSize = sizeof(more);
+    unsigned int r;
+    bool deep;
+
+    do {
+        pending->nroute = 0;
+        deep = false;
+        zmq_msg_init(&part);
+        if (zmq_msg_recv(&part, socket, flags) == -1) {
+            zmq_msg_close(&part);
+            return -1;
+        }
+
+        while (1) {
+            zmq_getsockopt(socket, ZMQ_RCVMORE, &more, &moreSize);
+            if (!more) {                                // The last frame is the payload
+                size = (int)zmq_msg_size(&part);
+                memcpy(pending->request, zmq_msg_data(&part), (size < ESEM_MAX_REQUEST_BYTES) ? size : ESEM_MAX_REQUEST_BYTES);
+                zmq_msg_close(&part);
+                break;
+            }
+            if (pending->nroute < ESEM_MAX_ROUTE) {
+                zmq_msg_init(&pending->route[pending->nroute]);
+                zmq_msg_move(&pending->route[pending->nroute], &part);
+                pending->nroute++;
+            } else {                                    // Drained all the same, the next receive releases the frame
+                deep = true;
+            }
+            zmq_msg_recv(&part, socket, 0);
+        }
+
+        if (deep) {
+            for (r = 0; r < pending->nroute; r++) {
+                zmq_msg_close(&pending->route[r]);
+            }
+            atomic_fetch_add_explicit(&metrics->dropped, 1, memory_order_relaxed);
+        }
+    } while (deep);
+
+    pending->requestLen = size;
+    pending->arrivalUs = ESEM_Now_us();
+    if (stamped && pending->nroute > 0 && zmq_msg_size(&pending->route[0]) == sizeof(long)) {
+        memcpy(&pending->arrivalUs, zmq_msg_data(&pending->route[0]), sizeof(long));
+    }
+    return size;
+}
+
+
+static void ESEM_Release(void *data, void *hint)
+{ // Called by ZMQ, possibly from an I/O thread, once it is done with a frame sent out of an arena
+
+    esem_arena_t *arena = (esem_arena_t*)hint;
+    (void)data;
+
+    if (atomic_fetch_sub(&arena->refs, 1) == 1) {     // The worker has already dropped the arena
+        free(arena);
+    }
+}
+
+
+static void ESEM_Send_Reply(void *socket, esem_request_t *pending, esem_arena_t *arena, unsigned char *frames, unsigned int *frameLen, unsigned int count, bool busy)
+{ // Sends the reply behind the routing envelope of the request it answers: one frame per commitment, taken from
+  // frames with a stride of ESEM_MAX_FRAME_BYTES, where an empty frame stands for a malformed entry, or the busy
+  // reply. The frames are handed to ZMQ without copying and stay in the arena until ESEM_Release is called for them,
+  // unless the arena is a copied one.
+
+    unsigned int r;
+    unsigned char busyReply = ESEM_BUSY;
+    zmq_msg_t part;
+
+    for (r = 0; r < pending->nroute; r++) {
+        zmq_msg_send(&pending->route[r], socket, ZMQ_SNDMORE);
+        zmq_msg_close(&pending->route[r]);
+    }
+    if (busy) {
+        zmq_send(socket, &busyReply, 1, 0);
+        return;
+    }
+    if (count == 0) {
+        zmq_send(socket, NULL, 0, 0);
+    }
+    for (r = 0; r < count; r++) {
+        if (frameLen[r] == 0) {
+            zmq_send(socket, NULL, 0, (r+1 < count) ? ZMQ_SNDMORE : 0);
+            continue;
+        }
+        if (arena->copied) {
+            zmq_send(socket, frames + r*ESEM_MAX_FRAME_BYTES, frameLen[r], (r+1 < count) ? ZMQ_SNDMORE : 0);
+            continue;
+        }
+        atomic_fetch_add(&arena->refs, 1);
+        zmq_msg_init_data(&part, frames + r*ESEM_MAX_FRAME_BYTES, frameLen[r], ESEM_Release, arena);
+        if (zmq_msg_send(&part, socket, (r+1 < count) ? ZMQ_SNDMORE : 0) == -1) {
+            zmq_msg_close(&part);                     // Releases the arena reference
+        }
+    }
+}
+
+
+static esem_arena_t *ESEM_New_Arena(size_t frameBytes, bool copied)
+{
+    esem_arena_t *arena = malloc(sizeof(esem_arena_t) + frameBytes);
+
+    if (arena != NULL) {
+        atomic_init(&arena->refs, 1);
+        arena->copied = copied;
+    }
+    return arena;
+}
+
+
+static esem_arena_t *ESEM_Next_Arena(esem_arena_t *arena[ESEM_REPLY_ARENAS+1], unsigned int *next, size_t frameBytes)
+{ // Returns the next arena of the ring, arena[ESEM_REPLY_ARENAS] being a copied one. An arena that ZMQ still sends
+  // from, e.g. to a peer that stopped reading its replies, is left to the last ESEM_Release and replaced by a new one
+  // instead of being waited for. The copied arena serves if the new one cannot be allocated.
+
+    esem_arena_t *a = arena[*next], *fresh;
+
+    if (atomic_load(&a->refs) != 1) {
+        fresh = ESEM_New_Arena(frameBytes, false);
+        if (fresh == NULL) {
+            return arena[ESEM_REPLY_ARENAS];
+        }
+        if (atomic_fetch_sub(&a->refs, 1) == 1) {      // Released meanwhile
+            free(a);
+        }
+        arena[*next] = a = fresh;
+    }
+    *next = (*next + 1) % ESEM_REPLY_ARENAS;
+    return a;
+}
+
+
+static void ESEM_Report(esem_server_t *server)
+{ // Prints the server counters once every server->reportUs microseconds, from whichever worker gets there first
+
+    uint64_t hits, misses, maps, evictions;
+    uint32_t devices, resident;
+    unsigned long requests, nodeRequests;
+    esem_store_t *store;
+    esem_node_t *node;
+    unsigned int n;
+    long now;
+
+    if (server->reportUs <= 0 || pthread_mutex_trylock(&server->reportLock) != 0) {
+        return;
+    }
+    now = ESEM_Now_us();
+    if (now >= server->nextReportUs) {
+        requests = atomic_load(&server->requests);
+        if (server->nextReportUs != 0) {
+            printf("  Requests: %lu total, %.0f requests/s, %lu busy\n", requests,
+                   1e6*(requests - server->lastReportRequests)/(double)(now - server->lastReportUs), atomic_load(&server->busy));
+            for (n = 0; server->numa && n < server->nnodes; n++) {
+                node = &server->nodes[n];
+                nodeRequests = atomic_load(&node->requests);
+                printf("  Node %d: %.0f requests/s, %lu commitments, %lu from remote tables\n", node->id,
+                       1e6*(nodeRequests - node->lastReportRequests)/(double)(now - server->lastReportUs),
+                       atomic_load(&node->commitments), atomic_load(&node->remote));
+                node->lastReportRequests = nodeRequests;
+            }
+            if (server->cache != NULL) {
+                ESEM_Cache_Stats(server->cache, &hits, &misses);
+                printf("  Commitment cache: %llu hits, %llu misses (%.1f%% hit rate)\n", (unsigned long long)hits, (unsigned long long)misses,
+                       (hits + misses) ? 100.0*hits/(hits + misses) : 0.0);
+            }
+            store = atomic_load(&server->store);                     // The caller is inside a batch, the store cannot be closed
+            if (store != NULL) {
+                ESEM_Store_Stats(store, &devices, &resident, &maps, &evictions);
+                printf("  Device store: %u devices, %u mapped, %llu maps, %llu evictions\n", devices, resident,
+                       (unsigned long long)maps, (unsigned long long)evictions);
+            }
+            fflush(stdout);
+        }
+        server->lastReportRequests = requests;
+        server->lastReportUs = now;
+        server->nextReportUs = now + server->reportUs;
+    }
+    pthread_mutex_unlock(&server->reportLock);
+}
+
+
+static void ESEM_Report_Ready(esem_server_t *server, const char *endpoint)
+{ // Reports the startup time once the endpoint is bound and the workers are running
+
+    if (server->startUs != 0) {
+        printf("Serving on %s, ready %.1f ms after start\n", endpoint, (ESEM_Now_us() - server->startUs)/1000.0);
+        fflush(stdout);
+    }
+}
+
+
+static void ESEM_Swap_Slots(unsigned int *slot, unsigned int *slotEntry, unsigned int *slotParty, unsigned int a, unsigned int b)
+{
+    unsigned int t;
+
+    t = slot[a]; slot[a] = slot[b]; slot[b] = t;
+    t = slotEntry[a]; slotEntry[a] = slotEntry[b]; slotEntry[b] = t;
+    t = slotParty[a]; slotParty[a] = slotParty[b]; slotParty[b] = t;
+}
+
+
+static ECCRYPTO_STATUS ESEM_Serve(esem_server_t *server, void *socket, unsigned int reader, bool stamped, esem_node_t *node)
+{ // Request loop shared by the single-threaded server and the pool workers. Pending requests are collected until
+  // server->batchWindow requests are queued or server->batchWindowUs microseconds have passed since the first one,
+  // and all partial commitments of the batch are normalized together with eccnorm_batch, except those of requests
+  // asking for projective responses, which are sent unnormalized. Returns when the socket's context is terminated.
+  // While a batch is in progress, server->readers[reader] holds the store version it started under, so that
+  // ESEM_Server_Reload does not close a store the batch is using. Requests that are more than server->deadlineUs
+  // old when their batch starts, counted from their arrival at the server, are answered busy without being computed.
+  // The built-in tables are read from the replica of the node the caller runs on. The commitments of requests of a
+  // class in server->splitClasses are handed to the party pool first, and the caller helps with them after
+  // computing the others. A batched request is one request towards the window and as many signatures as it has
+  // entries: the batch also stops taking requests once it holds server->batchWindow signatures. Its entries are
+  // computed and normalized with those of the other requests, and answered in one reply.
+
+    ECCRYPTO_STATUS Status = ECCRYPTO_SUCCESS;
+    unsigned int i, j, k, m, n, e, ne, a, s, window, capacity, count, remote, split, splitLeft = 0;
+    int64_t cycles;
+    esem_metrics_t *metrics = &server->metrics;
+    long deadline, remaining;
+    unsigned int mask[ESEM_MAX_ENTRIES], flags[ESEM_MAX_ENTRIES];
+    bool busy[ESEM_MAX_BATCH];
+    long now;
+    unsigned int slot[ESEM_MAX_ENTRIES*ESEM_L], slotEntry[ESEM_MAX_ENTRIES*ESEM_L], slotParty[ESEM_MAX_ENTRIES*ESEM_L];
+    unsigned int frameLen[ESEM_MAX_ENTRIES*ESEM_L], normSlot[ESEM_MAX_ENTRIES*ESEM_L];
+    unsigned int firstEntry[ESEM_MAX_BATCH+1], entrySlot[ESEM_MAX_ENTRIES+1];
+    unsigned char *entry[ESEM_MAX_ENTRIES];
+    int entryLen[ESEM_MAX_ENTRIES];
+    bool splitEntry[ESEM_MAX_ENTRIES];
+    esem_party_job_t *jobs;
+    esem_request_t *pending;
+    point_extproj_t *RVerify;
+    point_t *normalized;
+    unsigned char *frames;
+    esem_device_t builtin, *device[ESEM_MAX_ENTRIES], *dev;
+    esem_store_t *store;
+    uint32_t id;
+    esem_arena_t *arena[ESEM_REPLY_ARENAS+1] = {NULL}, *current;
+    unsigned int nextArena = 0;
+    zmq_pollitem_t items[1];
+
+    window = server->batchWindow;
+    if (window == 0 || window > ESEM_MAX_BATCH) {
+        return ECCRYPTO_ERROR_INVALID_PARAMETER;
+    }
+    capacity = window + ESEM_MAX_SIGNATURES - 1;                         // Signatures of a full batch
+    pending = malloc(window*sizeof(esem_request_t));
+    RVerify = malloc(capacity*ESEM_L*sizeof(point_extproj_t));
+    normalized = malloc(capacity*ESEM_L*sizeof(point_t));
+    jobs = malloc(capacity*ESEM_L*sizeof(esem_party_job_t));
+    for (i = 0; i <= ESEM_REPLY_ARENAS; i++) {                           // Reply buffers, replaced only if ZMQ holds on to them
+        arena[i] = ESEM_New_Arena(capacity*ESEM_L*ESEM_MAX_FRAME_BYTES, i == ESEM_REPLY_ARENAS);
+        if (arena[i] == NULL) {
+            Status = ECCRYPTO_ERROR_NO_MEMORY;
+            goto cleanup;
+        }
+    }
+    if (pending == NULL || RVerify == NULL || normalized == NULL || jobs == NULL) {
+        Status = ECCRYPTO_ERROR_NO_MEMORY;
+        goto cleanup;
+    }
+    items[0].socket = socket;
+    items[0].events = ZMQ_POLLIN;
+    builtin.id = 0;                                                      // The tables the server was started with
+    builtin.key = 0;
+    builtin.node = (node->id >= 0) ? ESEM_Numa_Node_Of(node->publicTable[0]) : -1;
+    for (j = 0; j < ESEM_L; j++) {
+        builtin.publicTable[j] = node->publicTable[j];
+        builtin.tempKey[j] = server->tempKey[j];
+    }
+
+    while (1) {
+        if (ESEM_Recv_Request(socket, &pending[0], 0, stamped, metrics) == -1) {            // Block until the first request of the batch arrives
+            break;
+        }
+        if (!stamped) {                                                  // Without a broker to log it
+            ESEM_Reqlog_Request(server->requestLog, pending[0].arrivalUs, pending[0].request, pending[0].requestLen);
+        }
+        ESEM_TRACE_BEGIN(ESEM_EV_BATCH, 0);
+        ESEM_TRACE_BEGIN(ESEM_EV_RECV, 0);
+        n = 1;
+        firstEntry[0] = 0;
+        ne = ESEM_Entries(pending[0].request, pending[0].requestLen, entry, entryLen);
+        deadline = ESEM_Now_us() + server->batchWindowUs;
+        atomic_store(&server->readers[reader], atomic_load(&server->version));
+        store = atomic_load(&server->store);                            // Used for the whole batch
+
+        while (n < window && ne < window) {
+            if (ESEM_Recv_Request(socket, &pending[n], ZMQ_DONTWAIT, stamped, metrics) != -1) {
+                if (!stamped) {
+                    ESEM_Reqlog_Request(server->requestLog, pending[n].arrivalUs, pending[n].request, pending[n].requestLen);
+                }
+                firstEntry[n++] = ne;
+                ne += ESEM_Entries(pending[n-1].request, pending[n-1].requestLen, entry + ne, entryLen + ne);
+                continue;
+            }
+            remaining = deadline - ESEM_Now_us();
+            if (remaining <= 0) {
+                break;
+            }
+            zmq_poll(items, 1, (remaining >= 1000) ? remaining/1000 : 0); // zmq_poll has millisecond resolution, spin below that
+        }
+        firstEntry[n] = ne;
+        ESEM_TRACE_END(ESEM_EV_RECV, n);
+
+        current = ESEM_Next_Arena(arena, &nextArena, capacity*ESEM_L*ESEM_MAX_FRAME_BYTES);
+        frames = current->frames;
+        now = ESEM_Now_us();
+        for (i = 0, k = 0, m = 0; i < n; i++) {                          // k indexes the reply frames, m the commitments to compute
+            busy[i] = server->deadlineUs > 0 && now - pending[i].arrivalUs > server->deadlineUs;
+            for (e = firstEntry[i]; e < firstEntry[i+1]; e++) {
+                mask[e] = ESEM_Parties(entry[e], entryLen[e]);
+                flags[e] = ESEM_Flags(entry[e], entryLen[e]);
+                splitEntry[e] = server->party != NULL && (server->splitClasses & (1 << ESEM_Class(entry[e], entryLen[e])));
+                if (busy[i]) {                                            // Shed, the verifier would see it late anyway
+                    mask[e] = 0;
+                }
+                device[e] = &builtin;
+                if (mask[e] != 0 && ESEM_Device(entry[e], entryLen[e], &id)) {
+                    device[e] = (store != NULL) ? ESEM_Store_Acquire(store, id) : NULL;
+                    if (device[e] == NULL) {                              // Unknown device, answered as a malformed entry
+                        mask[e] = 0;
+                    }
+                }
+                entrySlot[e] = k;
+                if (mask[e] == 0) {
+                    frameLen[k++] = 0;
+                }
+                for (j = 0; j < ESEM_L; j++) {
+                    if (mask[e] & (1 << j)) {
+                        frameLen[k] = ESEM_POINT_BYTES;
+                        if (server->cache == NULL || !ESEM_Cache_Get(server->cache, device[e]->key | j, entry[e], frames + k*ESEM_MAX_FRAME_BYTES)) {
+                            slotEntry[m] = e;
+                            slotParty[m] = j;
+                            slot[m++] = k;
+                        }
+                        k++;
+                    }
+                }
+            }
+        }
+        entrySlot[ne] = k;
+
+        for (i = 0, split = 0; i < m; i++) {                               // Commitments for the pool go to the back
+            split += splitEntry[slotEntry[i]];
+        }
+        for (i = 0, s = m - split; i < m - split; i++) {
+            if (splitEntry[slotEntry[i]]) {
+                for (; splitEntry[slotEntry[s]]; s++);
+                ESEM_Swap_Slots(slot, slotEntry, slotParty, i, s);
+            }
+        }
+        for (i = m - split; i < m; i++) {
+            dev = device[slotEntry[i]];
+            jobs[i].block = (server->subsetBlock != 0 && dev == &builtin) ? server->subsetBlock : 0;
+            jobs[i].table = (jobs[i].block != 0) ? node->subsetTable[slotParty[i]] : dev->publicTable[slotParty[i]];
+            jobs[i].tempKey = dev->tempKey[slotParty[i]];
+            jobs[i].randValue = entry[slotEntry[i]];
+            jobs[i].R = RVerify[i];
+            jobs[i].remaining = &splitLeft;
+        }
+        if (split != 0) {
+            ESEM_Party_Post(server->party, jobs + m - split, split);
+        }
+
+        for (i = 0; i < m - split; i += count) {                          // Four independent aggregations at a time where possible,
+            dev = device[slotEntry[i]];                                   // the last two or three in lock-step
+            cycles = cpucycles();
+            count = (server->subsetBlock != 0) ? 1 : (m - split - i >= 4) ? 4 : m - split - i;
+            if (count > 1) {
+                point_precomp_t *publicTable[4];
+                unsigned char *tempKey[4], *randValue[4];
+
+                for (k = 0; k < count; k++) {
+                    publicTable[k] = device[slotEntry[i+k]]->publicTable[slotParty[i+k]];
+                    tempKey[k] = device[slotEntry[i+k]]->tempKey[slotParty[i+k]];
+                    randValue[k] = entry[slotEntry[i+k]];
+                }
+                if (count == 4) {
+                    ESEM_Commit_x4(publicTable, tempKey, randValue, RVerify + i);
+                } else {
+                    ESEM_Commit_Interleaved(publicTable, tempKey, randValue, count, RVerify + i);
+                }
+            } else if (server->subsetBlock != 0 && dev == &builtin) {    // Subset-sum tables exist for the built-in tables only
+                ESEM_Commit_Subsets(node->subsetTable[slotParty[i]], server->subsetBlock, dev->tempKey[slotParty[i]], entry[slotEntry[i]], RVerify[i]);
+            } else {
+                ESEM_Commit(dev->publicTable[slotParty[i]], dev->tempKey[slotParty[i]], entry[slotEntry[i]], RVerify[i]);
+            }
+            cycles = (cpucycles() - cycles)/count;                        // Shared evenly by the commitments of the group
+            for (k = i; k < i + count; k++) {
+                jobs[k].cycles = cycles;
+            }
+        }
+        if (split != 0) {
+            ESEM_Party_Wait(server->party, &splitLeft);
+        }
+        for (i = 0; i < m; i++) {
+            ESEM_Hist_Add(&metrics->aggregationCycles, (uint64_t)jobs[i].cycles);
+            atomic_fetch_add_explicit(&metrics->partyCycles[slotParty[i]], (unsigned long)jobs[i].cycles, memory_order_relaxed);
+            atomic_fetch_add_explicit(&metrics->partyCommitments[slotParty[i]], 1, memory_order_relaxed);
+        }
+
+        for (i = 0, remote = 0; i < m && node->id >= 0; i++) {
+            dev = device[slotEntry[i]];
+            remote += (dev->node >= 0 && dev->node != node->id);
+        }
+        atomic_fetch_add(&node->commitments, m);
+        atomic_fetch_add_explicit(&metrics->commitments, m, memory_order_relaxed);
+        atomic_fetch_add(&node->remote, remote);
+
+        for (i = 0, a = 0; i < m; i++) {                                  // Projective responses are encoded as they are,
+            if ((flags[slotEntry[i]] & ESEM_FLAGS) == ESEM_FLAG_PROJECTIVE) { // the others are moved to the front of RVerify
+                ESEM_Encode_Projective(RVerify[i], frames + slot[i]*ESEM_MAX_FRAME_BYTES);
+                frameLen[slot[i]] = ESEM_PROJ_BYTES;
+            } else {
+                if (a != i) {
+                    memcpy(RVerify[a], RVerify[i], sizeof(point_extproj_t));
+                }
+                normSlot[a++] = i;
+            }
+        }
+
+        ESEM_TRACE_BEGIN(ESEM_EV_NORMALIZE, a);
+        cycles = cpucycles();
+        eccnorm_batch(RVerify, normalized, a);
+        if (a != 0) {
+            ESEM_Hist_Add(&metrics->normalizationCycles, (uint64_t)(cpucycles() - cycles));
+        }
+        ESEM_TRACE_END(ESEM_EV_NORMALIZE, a);
+        for (i = 0; i < a; i++) {
+            memcpy(frames + slot[normSlot[i]]*ESEM_MAX_FRAME_BYTES, normalized[i], ESEM_POINT_BYTES);
+            if (server->cache != NULL) {
+                ESEM_Cache_Put(server->cache, device[slotEntry[normSlot[i]]]->key | slotParty[normSlot[i]], entry[slotEntry[normSlot[i]]], (unsigned char*)normalized[i]);
+            }
+        }
+
+        ESEM_TRACE_BEGIN(ESEM_EV_SEND, n);
+        for (i = 0; i < n; i++) {                                         // The frames of a request's entries are contiguous
+            for (e = firstEntry[i]; e < firstEntry[i+1]; e++) {
+                for (k = entrySlot[e]; (flags[e] & ESEM_FLAG_COMPRESSED) && k < entrySlot[e+1]; k++) {
+                    if (frameLen[k] != 0) {
+                        ESEM_Encode_Compressed(frames + k*ESEM_MAX_FRAME_BYTES);
+                        frameLen[k] = ESEM_COMPRESSED_BYTES;
+                    }
+                }
+            }
+            k = entrySlot[firstEntry[i]];
+            ESEM_Send_Reply(socket, &pending[i], current, frames + k*ESEM_MAX_FRAME_BYTES, frameLen + k, entrySlot[firstEntry[i+1]] - k, busy[i]);
+            if (busy[i]) {
+                atomic_fetch_add(&server->busy, 1);
+            }
+            for (e = firstEntry[i]; e < firstEntry[i+1]; e++) {
+                if (device[e] != NULL && device[e] != &builtin) {
+                    ESEM_Store_Release(store, device[e]);
+                }
+            }
+        }
+        ESEM_TRACE_END(ESEM_EV_SEND, n);
+        now = ESEM_Now_us();
+        for (i = 0; i < n; i++) {
+            ESEM_Hist_Add(&metrics->latencyUs, (uint64_t)(now - pending[i].arrivalUs));
+        }
+        ESEM_Hist_Add(&metrics->batchSize, n);
+        atomic_fetch_add_explicit(&metrics->signatures, ne, memory_order_relaxed);
+        atomic_fetch_add_explicit(&metrics->batches, 1, memory_order_relaxed);
+        atomic_fetch_add(&server->requests, n);
+        atomic_fetch_add(&node->requests, n);
+        ESEM_Report(server);
+        atomic_store(&server->readers[reader], 0);
+        ESEM_TRACE_END(ESEM_EV_BATCH, n);
+    }
+
+cleanup:
+    free(pending);
+    free(RVerify);
+    free(normalized);
+    free(jobs);
+    for (i = 0; i <= ESEM_REPLY_ARENAS; i++) {                           // Arenas with frames still queued in ZMQ are freed
+        if (arena[i] != NULL && atomic_fetch_sub(&arena[i]->refs, 1) == 1) { // by the last ESEM_Release
+            free(arena[i]);
+        }
+    }
+
+    return Status;
+}
+
+
+static bool ESEM_Readers_New(esem_server_t *server, unsigned int nreaders)
+{ // Publishes one reader slot per thread running ESEM_Serve
+
+    atomic_ulong *readers = malloc(nreaders*sizeof(atomic_ulong));
+    unsigned int w;
+
+    if (readers == NULL) {
+        return false;
+    }
+    for (w = 0; w < nreaders; w++) {
+        atomic_init(&readers[w], 0);
+    }
+    pthread_mutex_lock(&server->reloadLock);
+    server->readers = readers;
+    server->nreaders = nreaders;
+    pthread_mutex_unlock(&server->reloadLock);
+    return true;
+}
+
+
+static void ESEM_Readers_Free(esem_server_t *server)
+{
+    pthread_mutex_lock(&server->reloadLock);
+    free(server->readers);
+    server->readers = NULL;
+    server->nreaders = 0;
+    pthread_mutex_unlock(&server->reloadLock);
+}
+
+
+ECCRYPTO_STATUS ESEM_Server_Reload(esem_server_t *server, const char *storeDir)
+{ // Read-copy-update of the device store: the new store is opened and warmed up off the request path, swapped in,
+  // and the old one is closed after every batch that may have started with it has finished
+
+    esem_store_t *store, *old;
+    unsigned long version, seen;
+    unsigned int w;
+
+    store = ESEM_Store_Open(storeDir, ESEM_STORE_RESIDENT);
+    if (store == NULL) {
+        return ECCRYPTO_ERROR;
+    }
+
+    pthread_mutex_lock(&server->reloadLock);
+    old = atomic_load(&server->store);
+    if (old != NULL) {
+        ESEM_Store_Warm(store, old);                                     // Devices in use stay mapped across the swap
+    }
+    old = atomic_exchange(&server->store, store);
+    version = atomic_fetch_add(&server->version, 1) + 1;
+    for (w = 0; w < server->nreaders; w++) {                             // Grace period
+        while ((seen = atomic_load(&server->readers[w])) != 0 && seen < version) {
+            usleep(100);
+        }
+    }
+    pthread_mutex_unlock(&server->reloadLock);
+
+    ESEM_Store_Close(old);
+    return ECCRYPTO_SUCCESS;
+}
+
+
+static size_t ESEM_Subset_Bytes(unsigned int block)
+{ // Size of a subset-sum table, see ESEM_Precompute_Subsets
+
+    return (size_t)((BPV_N + block - 1)/block)*((1 << block) - 1)*sizeof(point_precomp_t);
+}
+
+
+static bool ESEM_Nodes_New(esem_server_t *server)
+{ // Sets up the nodes the workers will run on. Without NUMA placement there is a single node serving the server's
+  // own tables.
+
+    esem_node_t *nodes = calloc(ESEM_NUMA_MAX_NODES, sizeof(esem_node_t));
+    unsigned int n, nnodes = 1, j;
+
+    if (nodes == NULL) {
+        return false;
+    }
+    if (server->numa) {
+        nnodes = ESEM_Numa_Discover(nodes, ESEM_NUMA_MAX_NODES);
+    } else {
+        nodes[0].id = -1;
+    }
+    for (n = 0; n < nnodes; n++) {
+        pthread_mutex_init(&nodes[n].lock, NULL);
+        atomic_init(&nodes[n].requests, 0);
+        atomic_init(&nodes[n].commitments, 0);
+        atomic_init(&nodes[n].remote, 0);
+        if (nodes[n].id < 0) {
+            for (j = 0; j < ESEM_L; j++) {
+                nodes[n].publicTable[j] = server->publicTable[j];
+                nodes[n].subsetTable[j] = server->subsetTable[j];
+            }
+            nodes[n].replicated = true;
+        }
+    }
+    server->nodes = nodes;
+    server->nnodes = nnodes;
+    return true;
+}
+
+
+static void ESEM_Nodes_Free(esem_server_t *server)
+{
+    unsigned int n, j;
+    esem_node_t *node;
+
+    for (n = 0; n < server->nnodes; n++) {
+        node = &server->nodes[n];
+        if (node->id >= 0 && node->replicated) {
+            for (j = 0; j < ESEM_L; j++) {
+                ESEM_Table_Free(node->publicTable[j]);
+                ESEM_Table_Free(node->subsetTable[j]);
+            }
+        }
+        pthread_mutex_destroy(&node->lock);
+    }
+    free(server->nodes);
+    server->nodes = NULL;
+    server->nnodes = 0;
+}
+
+
+static void *ESEM_Replica(const void *table, size_t bytes)
+{ // Copy of a read-only table in fresh pages, which the kernel places on the node of the calling thread when it
+  // first writes them. malloc could hand out pages already touched on another node.
+
+    void *copy = ESEM_Table_Alloc(bytes);
+
+    if (copy != NULL) {
+        memcpy(copy, table, bytes);
+    }
+    return copy;
+}
+
+
+static bool ESEM_Replicate(esem_server_t *server, esem_node_t *node)
+{ // Called by the workers of the node after pinning, the first one makes the node's replica of the tables
+
+    bool ok = true;
+    unsigned int j;
+
+    pthread_mutex_lock(&node->lock);
+    for (j = 0; j < ESEM_L && !node->replicated; j++) {
+        node->publicTable[j] = ESEM_Replica(server->publicTable[j], BPV_N*sizeof(point_precomp_t));
+        node->subsetTable[j] = (server->subsetTable[j] != NULL) ? ESEM_Replica(server->subsetTable[j], ESEM_Subset_Bytes(server->subsetBlock)) : NULL;
+        if (node->publicTable[j] == NULL || (server->subsetTable[j] != NULL && node->subsetTable[j] == NULL)) {
+            ok = false;
+            break;
+        }
+    }
+    if (!ok) {
+        for (; ; j--) {
+            ESEM_Table_Free(node->publicTable[j]);
+            ESEM_Table_Free(node->subsetTable[j]);
+            node->publicTable[j] = node->subsetTable[j] = NULL;
+            if (j == 0) break;
+        }
+    } else {
+        node->replicated = true;
+    }
+    pthread_mutex_unlock(&node->lock);
+    return ok;
+}
+
+
+ECCRYPTO_STATUS ESEM_Server_Batch(esem_server_t *server, const char *endpoint)
+{ // Serves requests from any number of verifiers on a single ZMQ_ROUTER socket in the calling thread
+
+    ECCRYPTO_STATUS Status;
+    bool numa = server->numa;
+
+    server->numa = false;                                                // A single thread has nothing to place
+    if (!ESEM_Readers_New(server, 1) || !ESEM_Nodes_New(server)) {
+        ESEM_Readers_Free(server);
+        server->numa = numa;
+        return ECCRYPTO_ERROR_NO_MEMORY;
+    }
+    void *context = zmq_ctx_new ();
+    void *responder = zmq_socket (context, ZMQ_ROUTER);
+    if (zmq_bind (responder, endpoint) != 0) {
+        Status = ECCRYPTO_ERROR;
+    } else {
+        ESEM_Report_Ready(server, endpoint);
+        Status = ESEM_Serve(server, responder, 0, false, &server->nodes[0]);
+    }
+
+    zmq_close (responder);
+    zmq_ctx_destroy (context);
+    ESEM_Readers_Free(server);
+    ESEM_Nodes_Free(server);
+    server->numa = numa;
+
+    return Status;
+}
+
+
+typedef struct {
+    esem_server_t *server;
+    void *context;
+    unsigned int index;
+    unsigned int node;                     // Index in server->nodes
+    unsigned int core;                     // Index of the worker among those of its node
+    ECCRYPTO_STATUS Status;
+} esem_worker_t;
+
+
+static void ESEM_Backend_Endpoint(char endpoint[64], unsigned int node)
+{ // One inproc backend per node
+
+    snprintf(endpoint, 64, "%s.%u", ESEM_BACKEND, node);
+}
+
+
+static void *ESEM_Worker(void *arg)
+{ // Worker thread: a ZMQ_DEALER socket on the inproc backend of its node receives whole envelopes, so replies find
+  // their way back through the frontend. All point temporaries are owned by the worker's ESEM_Serve call. With NUMA
+  // placement the worker is pinned to a core of its node before it touches its tables and buffers.
+
+    esem_worker_t *worker = (esem_worker_t*)arg;
+    esem_node_t *node = &worker->server->nodes[worker->node];
+    char endpoint[64];
+    void *socket;
+
+    ESEM_TRACE_THREAD("worker", (int)worker->index);
+    if (node->id >= 0 && node->ncpus > 0) {
+        ESEM_Numa_Pin(node->cpu[worker->core % node->ncpus]);
+    }
+    if (!ESEM_Replicate(worker->server, node)) {
+        worker->Status = ECCRYPTO_ERROR_NO_MEMORY;
+        return NULL;
+    }
+    socket = zmq_socket (worker->context, ZMQ_DEALER);
+    ESEM_Backend_Endpoint(endpoint, worker->node);
+    if (zmq_connect (socket, endpoint) != 0) {
+        worker->Status = ECCRYPTO_ERROR;
+    } else {
+        worker->Status = ESEM_Serve(worker->server, socket, worker->index, true, node);
+    }
+    zmq_close (socket);
+
+    return NULL;
+}
+
+
+static bool ESEM_Forward(void *from, void *to)
+{ // Moves the remaining frames of a multipart message from one socket to the other, without copying them
+
+    zmq_msg_t part;
+    int more = 1;
+    size_t moreSize = sizeof(more);
+
+    zmq_msg_init(&part);
+    while (more) {
+        if (zmq_msg_recv(&part, from, 0) == -1) {
+            zmq_msg_close(&part);
+            return false;
+        }
+        zmq_getsockopt(from, ZMQ_RCVMORE, &more, &moreSize);
+        zmq_msg_send(&part, to, more ? ZMQ_SNDMORE : 0);
+    }
+    zmq_msg_close(&part);
+    return true;
+}
+
+
+static int ESEM_Broker_Recv(void *frontend, zmq_msg_t frame[ESEM_MAX_ROUTE])
+{ // Receives a request from the frontend into frame, its routing envelope followed by the payload, and returns the
+  // number of frames. Returns 0 after draining a request whose envelope would exceed ESEM_MAX_ROUTE frames once
+  // stamped, which ESEM_Serve could not answer, or -1 on failure
+
+    zmq_msg_t spill, *part;
+    int n, f, more = 1;
+    size_t moreSize = sizeof(more);
+
+    for (n = 0; more; n++) {
+        part = (n < ESEM_MAX_ROUTE) ? &frame[n] : &spill;
+        zmq_msg_init(part);
+        if (zmq_msg_recv(part, frontend, 0) == -1) {
+            for (f = 0; f <= n && f < ESEM_MAX_ROUTE; f++) {
+                zmq_msg_close(&frame[f]);
+            }
+            return -1;
+        }
+        zmq_getsockopt(frontend, ZMQ_RCVMORE, &more, &moreSize);
+        if (part == &spill) {
+            zmq_msg_close(&spill);
+        }
+    }
+    if (n > ESEM_MAX_ROUTE) {
+        for (f = 0; f < ESEM_MAX_ROUTE; f++) {
+            zmq_msg_close(&frame[f]);
+        }
+        return 0;
+    }
+    return n;
+}
+
+
+static unsigned int ESEM_Home_Node(unsigned char *request, int requestLen, unsigned int nnodes)
+{ // Node serving the device named by the request, by its first entry that names one, or nnodes if none does. A device
+  // always goes to the same node, so its record is read into the page cache by a worker of that node, and its later
+  // requests find the tables in local memory. Other nodes only read it if the page cache already held it elsewhere.
+
+    unsigned char *entry[ESEM_MAX_SIGNATURES];
+    int entryLen[ESEM_MAX_SIGNATURES];
+    unsigned int e, count;
+    uint32_t id;
+
+    count = ESEM_Entries(request, requestLen, entry, entryLen);
+    for (e = 0; e < count; e++) {
+        if (ESEM_Device(entry[e], entryLen[e], &id)) {
+            return id % nnodes;
+        }
+    }
+    return nnodes;
+}
+
+
+static void ESEM_Broker(esem_server_t *server, void *frontend, void *backend[ESEM_NUMA_MAX_NODES], unsigned int nbackends)
+{ // Forwards requests from the frontend to the workers like zmq_proxy, but admits at most server->maxQueue requests at
+  // a time (any number if it is 0) and stamps each admitted request with its arrival time, for the deadline check of
+  // ESEM_Serve. Requests beyond that are answered busy right away, so the queueing delay stays bounded during bursts
+  // instead of growing with the backlog. With several nodes, a request naming a device goes to the home node of the
+  // device (see ESEM_Home_Node), any other request to the node with the fewest requests in progress. Every node holds a
+  // replica of the built-in tables, so all of them serve those requests from local memory. Returns when the context is
+  // terminated. Requests are logged to server->requestLog as they arrive, shed ones included. Requests whose envelope
+  // is too deep to be stamped are dropped here, before they take a place in the queue that no reply would ever free.
+
+    zmq_pollitem_t items[ESEM_NUMA_MAX_NODES + 1];
+    zmq_msg_t part, frame[ESEM_MAX_ROUTE];
+    unsigned int inflight = 0, nodeInflight[ESEM_NUMA_MAX_NODES] = {0}, b, target;
+    unsigned char busyReply = ESEM_BUSY;
+    int f, n;
+    long now;
+
+    for (b = 0; b < nbackends; b++) {
+        items[b].socket = backend[b];
+        items[b].events = ZMQ_POLLIN;
+    }
+    items[nbackends].socket = frontend;
+    items[nbackends].events = ZMQ_POLLIN;
+
+    while (1) {
+        if (zmq_poll(items, nbackends + 1, -1) == -1) {
+            break;
+        }
+        for (b = 0; b < nbackends; b++) {
+            if (items[b].revents & ZMQ_POLLIN) {                         // Reply: drop the stamp and pass on the rest
+                zmq_msg_init(&part);
+                if (zmq_msg_recv(&part, backend[b], 0) == -1) {
+                    zmq_msg_close(&part);
+                    return;
+                }
+                zmq_msg_close(&part);
+                if (!ESEM_Forward(backend[b], frontend)) {
+                    return;
+                }
+                inflight--;
+                nodeInflight[b]--;
+                atomic_store_explicit(&server->metrics.queueDepth, inflight, memory_order_relaxed);
+            }
+        }
+        if (items[nbackends].revents & ZMQ_POLLIN) {
+            now = ESEM_Now_us();
+            n = ESEM_Broker_Recv(frontend, frame);
+            if (n == -1) {
+                return;
+            }
+            if (n == 0) {
+                atomic_fetch_add_explicit(&server->metrics.dropped, 1, memory_order_relaxed);
+                continue;
+            }
+            ESEM_Reqlog_Request(server->requestLog, now, zmq_msg_data(&frame[n-1]), (int)zmq_msg_size(&frame[n-1]));
+            if (server->maxQueue == 0 || inflight < server->maxQueue) {
+                target = (nbackends > 1) ? ESEM_Home_Node(zmq_msg_data(&frame[n-1]), (int)zmq_msg_size(&frame[n-1]), nbackends) : 0;
+                if (target == nbackends) {
+                    for (b = 1, target = 0; b < nbackends; b++) {
+                        if (nodeInflight[b] < nodeInflight[target]) {
+                            target = b;
+                        }
+                    }
+                }
+                zmq_send(backend[target], &now, sizeof(now), ZMQ_SNDMORE);
+                for (f = 0; f < n; f++) {
+                    zmq_msg_send(&frame[f], backend[target], (f+1 < n) ? ZMQ_SNDMORE : 0);
+                }
+                inflight++;
+                nodeInflight[target]++;
+                atomic_store_explicit(&server->metrics.queueDepth, inflight, memory_order_relaxed);
+            } else {                                                     // Shed: echo the envelope, then the busy byte
+                for (f = 0; f+1 < n; f++) {
+                    zmq_msg_send(&frame[f], frontend, ZMQ_SNDMORE);
+                }
+                zmq_send(frontend, &busyReply, 1, 0);
+                atomic_fetch_add(&server->busy, 1);
+            }
+            for (f = 0; f < n; f++) {                                    // Sent frames are empty, closing them is a no-op
+                zmq_msg_close(&frame[f]);
+            }
+        }
+    }
+}
+
+
+ECCRYPTO_STATUS ESEM_Server_Pool(esem_server_t *server, const char *endpoint)
+{ // Serves requests with server->nworkers threads. A ZMQ_ROUTER frontend accepts the verifiers and ESEM_Broker
+  // forwards their requests to an inproc ZMQ_DEALER backend per node, which spreads them over the node's workers.
+  // Workers are assigned to the nodes round-robin.
+
+    ECCRYPTO_STATUS Status = ECCRYPTO_SUCCESS;
+    unsigned int i, n, nstarted = 0, nworkers = server->nworkers;
+    pthread_t *threads;
+    esem_worker_t *workers;
+    void *frontend, *backend[ESEM_NUMA_MAX_NODES] = {NULL};
+    char backendEndpoint[64];
+
+    if (nworkers == 0) {
+        return ESEM_Server_Batch(server, endpoint);
+    }
+    threads = malloc(nworkers*sizeof(pthread_t));
+    workers = malloc(nworkers*sizeof(esem_worker_t));
+    if (threads == NULL || workers == NULL || !ESEM_Readers_New(server, nworkers) || !ESEM_Nodes_New(server)) {
+        free(threads);
+        free(workers);
+        ESEM_Readers_Free(server);
+        return ECCRYPTO_ERROR_NO_MEMORY;
+    }
+    if (server->nnodes > nworkers) {                                     // Nodes without workers would get no requests
+        server->nnodes = nworkers;
+    }
+
+    void *context = zmq_ctx_new ();
+    zmq_ctx_set (context, ZMQ_IO_THREADS, 1 + nworkers/4);
+    frontend = zmq_socket (context, ZMQ_ROUTER);
+    if (zmq_bind (frontend, endpoint) != 0) {
+        Status = ECCRYPTO_ERROR;
+        goto cleanup;
+    }
+    for (n = 0; n < server->nnodes; n++) {
+        backend[n] = zmq_socket (context, ZMQ_DEALER);
+        ESEM_Backend_Endpoint(backendEndpoint, n);
+        if (zmq_bind (backend[n], backendEndpoint) != 0) {
+            Status = ECCRYPTO_ERROR;
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        workers[i].server = server;
+        workers[i].context = context;
+        workers[i].index = i;
+        workers[i].node = i % server->nnodes;
+        workers[i].core = i / server->nnodes;
+        workers[i].Status = ECCRYPTO_SUCCESS;
+        if (pthread_create(&threads[i], NULL, ESEM_Worker, &workers[i]) != 0) {
+            Status = ECCRYPTO_ERROR;
+            goto cleanup;
+        }
+        nstarted++;
+    }
+
+    ESEM_Report_Ready(server, endpoint);
+    ESEM_Broker (server, frontend, backend, server->nnodes); // Runs until the context is terminated
+
+cleanup:
+    zmq_close (frontend);
+    for (n = 0; n < server->nnodes; n++) {
+        if (backend[n] != NULL) {
+            zmq_close (backend[n]);
+        }
+    }
+    zmq_ctx_term (context);                                  // Unblocks the workers
+    for (i = 0; i < nstarted; i++) {
+        pthread_join(threads[i], NULL);
+        if (workers[i].Status != ECCRYPTO_SUCCESS) {
+            Status = workers[i].Status;
+        }
+    }
+    free(threads);
+    free(workers);
+    ESEM_Readers_Free(server);
+    ESEM_Nodes_Free(server);
+
+    return Status;
+}
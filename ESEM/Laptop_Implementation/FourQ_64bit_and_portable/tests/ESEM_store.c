@@ -0,0 +1,374 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: store of per-device BPV tables, memory-mapped on demand
+************************************************************************************/
+
+#include "ESEM.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+// A store is a directory holding two files:
+//   tables: the device records, back to back. A record is ESEM_L tables of BPV_N points in (x+y,y-x,2dt) form,
+//           followed by the ESEM_L keys shared with the parties (ESEM_STORE_RECORD_BYTES in total).
+//   index:  one (device id, record offset) pair per device, in any order. A device that is provisioned again gets a
+//           new record, and the one with the highest offset is used.
+// Only the index is loaded in memory. Records are mapped when a request for the device arrives, and the least
+// recently used ones are unmapped once more than "resident" devices are mapped. Records are never modified, so the
+// cache key of a device is derived from the offset of its record.
+
+#define ESEM_STORE_TABLES     "tables"
+#define ESEM_STORE_INDEX      "index"
+#define ESEM_STORE_PATH       4096
+#define ESEM_STORE_NONE       0xFFFFFFFF
+#define ESEM_STORE_RECORD_BYTES (ESEM_L*BPV_N*sizeof(point_precomp_t) + ESEM_L*32)
+
+typedef struct {
+    uint32_t id;
+    uint32_t slot;                         // Resident slot holding the record, or ESEM_STORE_NONE. Unused on disk
+    uint64_t offset;
+} esem_store_index_t;
+
+typedef struct {
+    esem_device_t device;                  // Must be the first member, ESEM_Store_Release gets the slot back from it
+    void *map;
+    size_t mapLen;
+    uint32_t entry;                        // Index entry of the mapped device
+    uint32_t refs;                         // Requests currently using the tables
+    uint32_t prev_lru, next_lru;           // Neighbours in the recency list, most recent first
+} esem_store_slot_t;
+
+struct esem_store {
+    pthread_mutex_t lock;
+    int fd;
+    size_t pageSize;
+    esem_store_index_t *index;             // Sorted by device id
+    uint32_t ndevices;
+    esem_store_slot_t *slots;
+    uint32_t nslots, capacity;
+    uint32_t head, tail;
+    uint64_t maps, evictions;
+};
+
+
+static void ESEM_Store_Path(char path[ESEM_STORE_PATH], const char *dir, const char *name)
+{
+    snprintf(path, ESEM_STORE_PATH, "%s/%s", dir, name);
+}
+
+
+ECCRYPTO_STATUS ESEM_Store_Add(const char *dir, uint32_t device, point_precomp_t *publicTable[ESEM_L], unsigned char *tempKey[ESEM_L])
+{ // Appends the tables and keys of a device to the store in dir, creating the store if needed
+
+    ECCRYPTO_STATUS Status = ECCRYPTO_ERROR;
+    char path[ESEM_STORE_PATH];
+    esem_store_index_t entry;
+    FILE *tables = NULL, *index = NULL;
+    long offset;
+    unsigned int j;
+
+    mkdir(dir, 0755);
+    ESEM_Store_Path(path, dir, ESEM_STORE_TABLES);
+    tables = fopen(path, "ab");
+    ESEM_Store_Path(path, dir, ESEM_STORE_INDEX);
+    index = fopen(path, "ab");
+    if (tables == NULL || index == NULL) {
+        goto cleanup;
+    }
+    fseek(tables, 0, SEEK_END);
+    offset = ftell(tables);
+    if (offset < 0) {
+        goto cleanup;
+    }
+    for (j = 0; j < ESEM_L; j++) {
+        if (fwrite(publicTable[j], sizeof(point_precomp_t), BPV_N, tables) != BPV_N) {
+            goto cleanup;
+        }
+    }
+    for (j = 0; j < ESEM_L; j++) {
+        if (fwrite(tempKey[j], 32, 1, tables) != 1) {
+            goto cleanup;
+        }
+    }
+    entry.id = device;
+    entry.slot = ESEM_STORE_NONE;
+    entry.offset = (uint64_t)offset;
+    if (fwrite(&entry, sizeof(entry), 1, index) != 1) {
+        goto cleanup;
+    }
+    Status = ECCRYPTO_SUCCESS;
+
+cleanup:
+    if (tables != NULL && fclose(tables) != 0) Status = ECCRYPTO_ERROR;
+    if (index != NULL && fclose(index) != 0) Status = ECCRYPTO_ERROR;
+    return Status;
+}
+
+
+static int ESEM_Store_Compare(const void *a, const void *b)
+{ // Orders the index by device id, then by offset
+
+    const esem_store_index_t *x = (const esem_store_index_t*)a, *y = (const esem_store_index_t*)b;
+
+    if (x->id != y->id) {
+        return (x->id > y->id) - (x->id < y->id);
+    }
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+
+esem_store_t* ESEM_Store_Open(const char *dir, unsigned int resident)
+{ // Loads the index of the store in dir. At most "resident" devices are kept mapped. Returns NULL on failure
+
+    esem_store_t *store;
+    char path[ESEM_STORE_PATH];
+    struct stat st;
+    FILE *index;
+    uint32_t i, n;
+
+    if (resident == 0) {
+        return NULL;
+    }
+    store = calloc(1, sizeof(esem_store_t));
+    if (store == NULL) {
+        return NULL;
+    }
+    store->fd = -1;
+
+    ESEM_Store_Path(path, dir, ESEM_STORE_INDEX);
+    index = fopen(path, "rb");
+    if (index == NULL || fstat(fileno(index), &st) != 0 || st.st_size % sizeof(esem_store_index_t) != 0) {
+        goto fail;
+    }
+    n = (uint32_t)(st.st_size/sizeof(esem_store_index_t));
+    store->index = malloc(n*sizeof(esem_store_index_t) + 1);
+    if (store->index == NULL || fread(store->index, sizeof(esem_store_index_t), n, index) != n) {
+        goto fail;
+    }
+    fclose(index);
+    index = NULL;
+    qsort(store->index, n, sizeof(esem_store_index_t), ESEM_Store_Compare);
+    for (i = 0; i < n; i++) {                                        // Keep the latest record of each device
+        if (i + 1 < n && store->index[i+1].id == store->index[i].id) {
+            continue;
+        }
+        store->index[store->ndevices++] = store->index[i];
+    }
+
+    ESEM_Store_Path(path, dir, ESEM_STORE_TABLES);
+    store->fd = open(path, O_RDONLY);
+    if (store->fd < 0 || fstat(store->fd, &st) != 0) {
+        goto fail;
+    }
+    for (i = 0; i < store->ndevices; i++) {
+        store->index[i].slot = ESEM_STORE_NONE;
+        if (store->index[i].offset > (uint64_t)st.st_size || (uint64_t)st.st_size - store->index[i].offset < ESEM_STORE_RECORD_BYTES) {
+            goto fail;
+        }
+    }
+
+    store->slots = malloc(resident*sizeof(esem_store_slot_t));
+    if (store->slots == NULL) {
+        goto fail;
+    }
+    store->capacity = resident;
+    store->head = store->tail = ESEM_STORE_NONE;
+    store->pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    pthread_mutex_init(&store->lock, NULL);
+    return store;
+
+fail:
+    if (index != NULL) fclose(index);
+    if (store->fd >= 0) close(store->fd);
+    free(store->index);
+    free(store);
+    return NULL;
+}
+
+
+void ESEM_Store_Close(esem_store_t *store)
+{ // Unmaps all devices. No device may be in use
+
+    uint32_t s;
+
+    if (store == NULL) {
+        return;
+    }
+    for (s = 0; s < store->nslots; s++) {
+        if (store->slots[s].entry != ESEM_STORE_NONE) {
+            munmap(store->slots[s].map, store->slots[s].mapLen);
+        }
+    }
+    pthread_mutex_destroy(&store->lock);
+    close(store->fd);
+    free(store->slots);
+    free(store->index);
+    free(store);
+}
+
+
+static void ESEM_Store_Unlink(esem_store_t *store, uint32_t s)
+{ // Removes slot s from the recency list
+
+    esem_store_slot_t *slot = &store->slots[s];
+
+    if (slot->prev_lru != ESEM_STORE_NONE) store->slots[slot->prev_lru].next_lru = slot->next_lru;
+    else store->head = slot->next_lru;
+    if (slot->next_lru != ESEM_STORE_NONE) store->slots[slot->next_lru].prev_lru = slot->prev_lru;
+    else store->tail = slot->prev_lru;
+}
+
+
+static void ESEM_Store_Push(esem_store_t *store, uint32_t s)
+{ // Inserts slot s as the most recently used one
+
+    esem_store_slot_t *slot = &store->slots[s];
+
+    slot->prev_lru = ESEM_STORE_NONE;
+    slot->next_lru = store->head;
+    if (store->head != ESEM_STORE_NONE) store->slots[store->head].prev_lru = s;
+    store->head = s;
+    if (store->tail == ESEM_STORE_NONE) store->tail = s;
+}
+
+
+static uint32_t ESEM_Store_Find(esem_store_t *store, uint32_t id)
+{ // Binary search of the index, returns the entry of the device or ESEM_STORE_NONE
+
+    uint32_t lo = 0, hi = store->ndevices, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo)/2;
+        if (store->index[mid].id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return (lo < store->ndevices && store->index[lo].id == id) ? lo : ESEM_STORE_NONE;
+}
+
+
+static bool ESEM_Store_Map(esem_store_t *store, uint32_t s, uint32_t e)
+{ // Maps the record of index entry e into slot s. mmap needs a page-aligned offset, records are not aligned
+
+    esem_store_slot_t *slot = &store->slots[s];
+    uint64_t offset = store->index[e].offset, start = offset & ~(uint64_t)(store->pageSize - 1);
+    unsigned char *record;
+    unsigned int j;
+
+    slot->mapLen = (size_t)(offset - start) + ESEM_STORE_RECORD_BYTES;
+    slot->map = mmap(NULL, slot->mapLen, PROT_READ, MAP_SHARED, store->fd, (off_t)start);
+    if (slot->map == MAP_FAILED) {
+        return false;
+    }
+    madvise(slot->map, slot->mapLen, MADV_WILLNEED);               // A commitment reads 40 scattered points of each table
+    record = (unsigned char*)slot->map + (offset - start);
+    (void)*(volatile unsigned char*)record;
+    slot->device.node = ESEM_Numa_Node_Of(record);                  // Where the page cache holds the record
+    for (j = 0; j < ESEM_L; j++) {
+        slot->device.publicTable[j] = (point_precomp_t*)(record + j*BPV_N*sizeof(point_precomp_t));
+        slot->device.tempKey[j] = record + ESEM_L*BPV_N*sizeof(point_precomp_t) + j*32;
+    }
+    slot->device.id = store->index[e].id;
+    slot->device.key = (store->index[e].offset + 1) << 8;
+    slot->entry = e;
+    store->index[e].slot = s;
+    store->maps++;
+    return true;
+}
+
+
+esem_device_t* ESEM_Store_Acquire(esem_store_t *store, uint32_t id)
+{ // Returns the tables of device id, mapping them if needed, or NULL if the device is unknown or no slot is free.
+  // The tables stay mapped until the matching ESEM_Store_Release.
+
+    uint32_t e, s;
+    esem_store_slot_t *slot;
+
+    pthread_mutex_lock(&store->lock);
+    e = ESEM_Store_Find(store, id);
+    if (e == ESEM_STORE_NONE) {
+        pthread_mutex_unlock(&store->lock);
+        return NULL;
+    }
+    s = store->index[e].slot;
+    if (s != ESEM_STORE_NONE) {
+        ESEM_Store_Unlink(store, s);
+    } else {
+        if (store->nslots < store->capacity) {
+            s = store->nslots++;
+        } else {                                                     // Evict the least recently used device not in use
+            for (s = store->tail; s != ESEM_STORE_NONE && store->slots[s].refs != 0; s = store->slots[s].prev_lru);
+            if (s == ESEM_STORE_NONE) {
+                pthread_mutex_unlock(&store->lock);
+                return NULL;
+            }
+            ESEM_Store_Unlink(store, s);
+            if (store->slots[s].entry != ESEM_STORE_NONE) {
+                munmap(store->slots[s].map, store->slots[s].mapLen);
+                store->index[store->slots[s].entry].slot = ESEM_STORE_NONE;
+                store->evictions++;
+            }
+        }
+        store->slots[s].refs = 0;
+        if (!ESEM_Store_Map(store, s, e)) {                          // Keep the slot as an empty one, reused when it reaches the tail
+            store->slots[s].entry = ESEM_STORE_NONE;
+            ESEM_Store_Push(store, s);
+            pthread_mutex_unlock(&store->lock);
+            return NULL;
+        }
+    }
+    slot = &store->slots[s];
+    slot->refs++;
+    ESEM_Store_Push(store, s);
+    pthread_mutex_unlock(&store->lock);
+
+    return &slot->device;
+}
+
+
+void ESEM_Store_Release(esem_store_t *store, esem_device_t *device)
+{
+    pthread_mutex_lock(&store->lock);
+    ((esem_store_slot_t*)device)->refs--;
+    pthread_mutex_unlock(&store->lock);
+}
+
+
+void ESEM_Store_Warm(esem_store_t *store, esem_store_t *from)
+{ // Maps the devices of "from" that are mapped, most recently used last, so that they are mapped in store too
+
+    uint32_t *ids, n = 0, s;
+    esem_device_t *device;
+
+    pthread_mutex_lock(&from->lock);
+    ids = malloc((from->nslots + 1)*sizeof(uint32_t));
+    if (ids != NULL) {
+        for (s = from->tail; s != ESEM_STORE_NONE; s = from->slots[s].prev_lru) {
+            if (from->slots[s].entry != ESEM_STORE_NONE) {
+                ids[n++] = from->slots[s].device.id;
+            }
+        }
+    }
+    pthread_mutex_unlock(&from->lock);
+
+    for (s = 0; s < n; s++) {
+        device = ESEM_Store_Acquire(store, ids[s]);
+        if (device != NULL) {
+            ESEM_Store_Release(store, device);
+        }
+    }
+    free(ids);
+}
+
+
+void ESEM_Store_Stats(esem_store_t *store, uint32_t *devices, uint32_t *resident, uint64_t *maps, uint64_t *evictions)
+{
+    pthread_mutex_lock(&store->lock);
+    *devices = store->ndevices;
+    *resident = store->nslots;
+    *maps = store->maps;
+    *evictions = store->evictions;
+    pthread_mutex_unlock(&store->lock);
+}
@@ -0,0 +1,167 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: per-thread ring buffers of trace events, for the request lifecycle of the server and the verifier
+************************************************************************************/
+
+#define _GNU_SOURCE
+#include "ESEM.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+
+
+// Each thread writes its events into its own ring, so a trace point is a clock read and a 16-byte store, without
+// locks or shared cache lines. Rings are linked into a global list on first use and never freed, so that a snapshot
+// still sees the events of threads that have exited. A snapshot copies the rings while their threads keep writing
+// and keeps only the events that cannot have been overwritten during the copy.
+
+#if (ESEM_TRACE_EVENTS & (ESEM_TRACE_EVENTS - 1)) != 0
+    #error -- "ESEM_TRACE_EVENTS must be a power of two"
+#endif
+
+struct esem_trace_ring {
+    struct esem_trace_ring *next;
+    uint32_t tid;
+    char name[ESEM_TRACE_NAME_BYTES];
+    atomic_ulong head;                     // Events ever written, event e is in event[e % ESEM_TRACE_EVENTS]
+    esem_trace_event_t event[ESEM_TRACE_EVENTS];
+};
+
+const char *ESEM_Trace_Names[ESEM_EV_COUNT] = {"recv", "indices", "gather", "aggregate", "normalize", "send", "batch", "party", "decode", "verify"};
+
+static esem_trace_ring_t * _Atomic ESEM_Trace_Rings = NULL;
+static _Thread_local esem_trace_ring_t *ESEM_Trace_Mine = NULL;
+
+
+static esem_trace_ring_t* ESEM_Trace_Ring(void)
+{ // Ring of the calling thread, created and registered on first use. NULL if it cannot be allocated
+
+    esem_trace_ring_t *ring = ESEM_Trace_Mine;
+
+    if (ring != NULL) {
+        return ring;
+    }
+    ring = calloc(1, sizeof(esem_trace_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->tid = (uint32_t)syscall(SYS_gettid);
+    snprintf(ring->name, ESEM_TRACE_NAME_BYTES, "thread %u", ring->tid);
+    atomic_init(&ring->head, 0);
+    ring->next = atomic_load(&ESEM_Trace_Rings);
+    while (!atomic_compare_exchange_weak(&ESEM_Trace_Rings, &ring->next, ring));
+    ESEM_Trace_Mine = ring;
+    return ring;
+}
+
+
+void ESEM_Trace_Thread(const char *name, int index)
+{
+    esem_trace_ring_t *ring = ESEM_Trace_Ring();
+
+    if (ring == NULL) {
+        return;
+    }
+    if (index >= 0) {
+        snprintf(ring->name, ESEM_TRACE_NAME_BYTES, "%s %d", name, index);
+    } else {
+        snprintf(ring->name, ESEM_TRACE_NAME_BYTES, "%s", name);
+    }
+}
+
+
+void ESEM_Trace_Event(unsigned int event, char phase, uint32_t arg)
+{
+    esem_trace_ring_t *ring = ESEM_Trace_Ring();
+    esem_trace_event_t *e;
+    struct timespec ts;
+    unsigned long head;
+
+    if (ring == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);     // Only this thread writes the ring
+    e = &ring->event[head & (ESEM_TRACE_EVENTS - 1)];
+    e->ns = (uint64_t)ts.tv_sec*1000000000 + (uint64_t)ts.tv_nsec;
+    e->arg = arg;
+    e->event = (uint16_t)event;
+    e->phase = (uint8_t)phase;
+    e->reserved = 0;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+
+unsigned char* ESEM_Trace_Snapshot(size_t *len)
+{ // Layout: ESEM_TRACE_MAGIC, uint32 number of rings, uint32 0, then per ring uint32 tid, uint32 number of events,
+  // the thread name in ESEM_TRACE_NAME_BYTES and the events, oldest first. All integers in host byte order
+
+    esem_trace_ring_t *ring;
+    unsigned char *snapshot, *p, *count;
+    unsigned long first, last, e, valid;
+    uint32_t nrings = 0, nevents, zero = 0;
+    size_t size = 16;
+
+    for (ring = atomic_load(&ESEM_Trace_Rings); ring != NULL; ring = ring->next) {
+        nrings++;
+        size += 8 + ESEM_TRACE_NAME_BYTES + ESEM_TRACE_EVENTS*sizeof(esem_trace_event_t);
+    }
+    snapshot = malloc(size);
+    if (snapshot == NULL) {
+        return NULL;
+    }
+    memcpy(snapshot, ESEM_TRACE_MAGIC, 8);
+    p = snapshot + 8;
+    memcpy(p, &nrings, 4);                                                // Rings registered meanwhile are left out
+    memcpy(p + 4, &zero, 4);
+    p += 8;
+
+    for (ring = atomic_load(&ESEM_Trace_Rings); nrings-- > 0; ring = ring->next) {
+        memcpy(p, &ring->tid, 4);
+        count = p + 4;
+        memcpy(p + 8, ring->name, ESEM_TRACE_NAME_BYTES);
+        p += 8 + ESEM_TRACE_NAME_BYTES;
+
+        last = atomic_load_explicit(&ring->head, memory_order_acquire);
+        first = (last > ESEM_TRACE_EVENTS) ? last - ESEM_TRACE_EVENTS : 0;
+        for (e = first; e < last; e++) {
+            memcpy(p + (e - first)*sizeof(esem_trace_event_t), &ring->event[e & (ESEM_TRACE_EVENTS - 1)], sizeof(esem_trace_event_t));
+        }
+        atomic_thread_fence(memory_order_acquire);
+        valid = atomic_load_explicit(&ring->head, memory_order_relaxed);  // The slots of the events up to valid - ESEM_TRACE_EVENTS
+        valid = (valid >= ESEM_TRACE_EVENTS) ? valid - ESEM_TRACE_EVENTS + 1 : 0; // may have been rewritten during the copy
+        if (valid >= last) {
+            first = last;
+        } else if (valid > first) {
+            memmove(p, p + (valid - first)*sizeof(esem_trace_event_t), (last - valid)*sizeof(esem_trace_event_t));
+            first = valid;
+        }
+        nevents = (uint32_t)(last - first);
+        memcpy(count, &nevents, 4);
+        p += nevents*sizeof(esem_trace_event_t);
+    }
+
+    *len = (size_t)(p - snapshot);
+    return snapshot;
+}
+
+
+bool ESEM_Trace_Save(const char *path)
+{
+    unsigned char *snapshot;
+    size_t len;
+    FILE *file;
+    bool ok;
+
+    snapshot = ESEM_Trace_Snapshot(&len);
+    if (snapshot == NULL) {
+        return false;
+    }
+    file = fopen(path, "wb");
+    ok = file != NULL && fwrite(snapshot, 1, len, file) == len;
+    if (file != NULL && fclose(file) != 0) {
+        ok = false;
+    }
+    free(snapshot);
+    return ok;
+}
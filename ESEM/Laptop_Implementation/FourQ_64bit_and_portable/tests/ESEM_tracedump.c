@@ -0,0 +1,151 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: converts ESEM trace snapshots to Chrome trace JSON
+************************************************************************************/
+
+#include "ESEM.h"
+#include "zmq.h"
+
+
+// Usage: ESEM_tracedump <snapshot file | stats endpoint> > trace.json
+// A snapshot is read from a file such as ESEM_TRACE_FILE, or fetched from the stats socket of a running server,
+// e.g. tcp://localhost:5556. The JSON loads in chrome://tracing or ui.perfetto.dev, one track per thread.
+
+#define ESEM_TRACEDUMP_TIMEOUT_MS  5000
+
+
+static unsigned char* ESEM_Tracedump_Fetch(const char *endpoint, size_t *len)
+{ // Snapshot returned by the stats socket at endpoint, NULL on failure
+
+    void *context = zmq_ctx_new();
+    void *requester = zmq_socket(context, ZMQ_REQ);
+    int timeout = ESEM_TRACEDUMP_TIMEOUT_MS, linger = 0;
+    unsigned char *snapshot = NULL;
+    zmq_msg_t reply;
+
+    zmq_setsockopt(requester, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    zmq_setsockopt(requester, ZMQ_LINGER, &linger, sizeof(linger));
+    zmq_msg_init(&reply);
+    if (zmq_connect(requester, endpoint) == 0 && zmq_send(requester, ESEM_TRACE_REQUEST, strlen(ESEM_TRACE_REQUEST), 0) != -1 &&
+        zmq_msg_recv(&reply, requester, 0) != -1) {
+        *len = zmq_msg_size(&reply);
+        snapshot = malloc(*len + 1);
+        if (snapshot != NULL) {
+            memcpy(snapshot, zmq_msg_data(&reply), *len);
+        }
+    }
+    zmq_msg_close(&reply);
+    zmq_close(requester);
+    zmq_ctx_destroy(context);
+    return snapshot;
+}
+
+
+static unsigned char* ESEM_Tracedump_Read(const char *path, size_t *len)
+{ // Contents of a snapshot file, NULL on failure
+
+    FILE *file = fopen(path, "rb");
+    unsigned char *snapshot = NULL;
+    long size;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+        snapshot = malloc((size_t)size + 1);
+        if (snapshot != NULL && fread(snapshot, 1, (size_t)size, file) != (size_t)size) {
+            free(snapshot);
+            snapshot = NULL;
+        }
+        *len = (size_t)size;
+    }
+    fclose(file);
+    return snapshot;
+}
+
+
+static bool ESEM_Tracedump_Json(const unsigned char *snapshot, size_t len, FILE *out)
+{ // Writes the events of the snapshot as B/E events with timestamps in microseconds from the earliest one, and the
+  // thread names as metadata. Ends whose beginning was overwritten in the ring are dropped. False if malformed
+
+    const unsigned char *p, *ring;
+    uint32_t nrings, r, tid, nevents, e, depth;
+    unsigned int pass;
+    uint64_t origin = UINT64_MAX;
+    esem_trace_event_t ev;
+    char name[ESEM_TRACE_NAME_BYTES + 1];
+
+    if (len < 16 || memcmp(snapshot, ESEM_TRACE_MAGIC, 8) != 0) {
+        return false;
+    }
+    memcpy(&nrings, snapshot + 8, 4);
+
+    for (pass = 0; pass < 2; pass++) {                                   // Validate and find the origin, then print
+        p = snapshot + 16;
+        for (r = 0; r < nrings; r++) {
+            if ((size_t)(snapshot + len - p) < 8 + ESEM_TRACE_NAME_BYTES) {
+                return false;
+            }
+            ring = p;
+            memcpy(&tid, ring, 4);
+            memcpy(&nevents, ring + 4, 4);
+            p += 8 + ESEM_TRACE_NAME_BYTES;
+            if ((size_t)(snapshot + len - p) / sizeof(esem_trace_event_t) < nevents) {
+                return false;
+            }
+            if (pass == 1) {
+                memcpy(name, ring + 8, ESEM_TRACE_NAME_BYTES);
+                name[ESEM_TRACE_NAME_BYTES] = 0;
+                fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", tid, name);
+            }
+            for (e = 0, depth = 0; e < nevents; e++, p += sizeof(esem_trace_event_t)) {
+                memcpy(&ev, p, sizeof(esem_trace_event_t));
+                if (pass == 0) {
+                    origin = (ev.ns < origin) ? ev.ns : origin;
+                    continue;
+                }
+                if (ev.event >= ESEM_EV_COUNT || (ev.phase != 'B' && ev.phase != 'E') || (ev.phase == 'E' && depth == 0)) {
+                    continue;
+                }
+                depth += (ev.phase == 'B') ? 1 : -1;
+                fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"arg\":%u}}",
+                        ESEM_Trace_Names[ev.event], ev.phase, (ev.ns - origin)/1000.0, tid, ev.arg);
+            }
+        }
+        if (pass == 0) {
+            fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"ESEM\"}}");
+        }
+    }
+    fprintf(out, "\n]}\n");
+    return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+    unsigned char *snapshot;
+    size_t len = 0;
+    bool ok;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <snapshot file | stats endpoint, e.g. tcp://localhost:5556>\n", argv[0]);
+        return 2;
+    }
+    snapshot = (strstr(argv[1], "://") != NULL) ? ESEM_Tracedump_Fetch(argv[1], &len) : ESEM_Tracedump_Read(argv[1], &len);
+    if (snapshot == NULL) {
+        fprintf(stderr, "Problem Occurred in reading the trace from %s\n", argv[1]);
+        return 1;
+    }
+    if (len == 0) {
+        fprintf(stderr, "Empty trace: the server was built without ESEM_TRACE (make TRACE=TRUE)\n");
+        free(snapshot);
+        return 1;
+    }
+    ok = ESEM_Tracedump_Json(snapshot, len, stdout);
+    if (!ok) {
+        fprintf(stderr, "Malformed trace snapshot\n");
+    }
+    free(snapshot);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,909 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: message transports between the verifier and the server: ZeroMQ, native TCP over io_uring and shared memory
+************************************************************************************/
+
+#define _GNU_SOURCE
+#include "ESEM.h"
+#include "zmq.h"
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <stddef.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+
+
+// A transport carries multipart messages with the semantics of a ZMQ_REQ/ZMQ_REP pair: the server answers each
+// request before receiving the next one. The ZeroMQ backend is that pair. The io_uring backend speaks plain TCP,
+// every frame being preceded by a 4-byte little-endian header holding its length and ESEM_FRAME_MORE. It sends and
+// receives through two buffers registered with the ring, one per direction, and does not submit a reply on its
+// own: the write is submitted together with the read of the next request (or of the reply, on the verifier side),
+// so that a round trip costs one io_uring_enter on each side.
+// The shared-memory backend is for a verifier on the same host as the server. The server creates two single-producer
+// single-consumer rings in a memfd for each verifier that connects to its unix socket, and passes the descriptor with
+// SCM_RIGHTS. Frames are then copied into the rings, with the same headers as over TCP, and a message is published
+// by moving the ring tail past its last frame. A waiting end spins for a while and then sleeps on a futex on the
+// tail, so no system call is made while both ends are busy. The unix socket only stays open to notice a peer that
+// dies. A verifier has its own pair of rings, so no ring ever has more than one producer.
+
+#define ESEM_FRAME_MORE       0x80000000
+#define ESEM_FRAME_HEADER     4
+#define ESEM_URING_ENTRIES    8
+#define ESEM_OP_ACCEPT        0           // user_data of the io_uring operations
+#define ESEM_OP_READ          1
+#define ESEM_OP_WRITE         2
+
+typedef struct {
+    _Atomic uint32_t tail;                 // Bytes ever published by the producer, futex of a waiting consumer
+    _Atomic uint32_t consumerWaiting;
+    unsigned char pad0[56];                // Keeps the producer's and the consumer's lines apart
+    _Atomic uint32_t head;                 // Bytes ever consumed, futex of a producer waiting for room
+    _Atomic uint32_t producerWaiting;
+    unsigned char pad1[56];
+    unsigned char data[ESEM_SHM_RING_BYTES];
+} esem_shm_ring_t;
+
+typedef struct {
+    _Atomic uint32_t closed;               // Set by the end that closes first
+    unsigned char pad[60];
+    esem_shm_ring_t ring[2];               // Requests, then replies
+} esem_shm_t;
+
+typedef struct {
+    int fd;
+    unsigned char *sq, *cq;                // Mapped rings, the same mapping with IORING_FEAT_SINGLE_MMAP
+    size_t sqLen, cqLen;
+    struct io_uring_sqe *sqes;
+    size_t sqesLen;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray, *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned int tail;                     // Submission tail, published to the kernel by ESEM_Uring_Enter
+    unsigned int queued;                   // Entries written and not submitted yet
+} esem_uring_t;
+
+struct esem_transport {
+    const struct esem_transport_ops *ops;
+    bool server;
+    void *context, *socket;                // ZeroMQ
+    int listenFd, fd;                      // io_uring and shm, fd is -1 while the server waits for a connection
+    esem_uring_t ring;
+    unsigned char *buffer;                 // Registered, receive buffer followed by send buffer
+    size_t recvLen, recvPos;               // Bytes received, start of the next unread frame
+    size_t sendLen, sendPos;               // Bytes of the message being sent, bytes already written
+    unsigned int inflight;                 // Bit ESEM_OP_* set while the operation is in the ring
+    int result[3];
+    esem_shm_t *shm;                       // Shared memory, NULL while the server waits for a connection
+    esem_shm_ring_t *in, *out;
+    uint32_t inHead, outTail;              // Own copies of the consumed head of in and of the written tail of out
+    unsigned int spin;                     // Polls of a ring before sleeping
+};
+
+typedef struct esem_transport_ops {
+    const char *name;
+    bool (*open)(esem_transport_t *transport, const char *endpoint);
+    int (*send)(esem_transport_t *transport, const void *data, size_t len, bool more);
+    int (*recv)(esem_transport_t *transport, void *buf, size_t size, bool *more);
+    void (*close)(esem_transport_t *transport);
+} esem_transport_ops_t;
+
+
+static bool ESEM_Zmq_Open(esem_transport_t *transport, const char *endpoint)
+{
+    transport->context = zmq_ctx_new();
+    transport->socket = zmq_socket(transport->context, transport->server ? ZMQ_REP : ZMQ_REQ);
+    if ((transport->server ? zmq_bind(transport->socket, endpoint) : zmq_connect(transport->socket, endpoint)) != 0) {
+        zmq_close(transport->socket);
+        zmq_ctx_destroy(transport->context);
+        return false;
+    }
+    return true;
+}
+
+
+static int ESEM_Zmq_Send(esem_transport_t *transport, const void *data, size_t len, bool more)
+{
+    return zmq_send(transport->socket, data, len, more ? ZMQ_SNDMORE : 0);
+}
+
+
+static int ESEM_Zmq_Recv(esem_transport_t *transport, void *buf, size_t size, bool *more)
+{
+    int rc, rcvMore = 0;
+    size_t moreSize = sizeof(rcvMore);
+
+    rc = zmq_recv(transport->socket, buf, size, 0);
+    if (rc != -1) {
+        zmq_getsockopt(transport->socket, ZMQ_RCVMORE, &rcvMore, &moreSize);
+    }
+    *more = rcvMore != 0;
+    return rc;
+}
+
+
+static void ESEM_Zmq_Close(esem_transport_t *transport)
+{
+    zmq_close(transport->socket);
+    zmq_ctx_destroy(transport->context);
+}
+
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+
+static bool ESEM_Uring_Setup(esem_uring_t *ring, unsigned int entries)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return false;
+    }
+    ring->sqLen = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    ring->cqLen = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sqLen = ring->cqLen = (ring->sqLen > ring->cqLen) ? ring->sqLen : ring->cqLen;
+    }
+    ring->sqesLen = params.sq_entries*sizeof(struct io_uring_sqe);
+    ring->sq = mmap(NULL, ring->sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq :
+               mmap(NULL, ring->cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq == MAP_FAILED || ring->cq == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sq != MAP_FAILED) {
+            munmap(ring->sq, ring->sqLen);
+        }
+        if (ring->cq != MAP_FAILED && ring->cq != ring->sq) {
+            munmap(ring->cq, ring->cqLen);
+        }
+        if (ring->sqes != MAP_FAILED) {
+            munmap(ring->sqes, ring->sqesLen);
+        }
+        close(ring->fd);
+        return false;
+    }
+    ring->sqHead = (unsigned*)(ring->sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(ring->sq + params.sq_off.tail);
+    ring->sqMask = (unsigned*)(ring->sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(ring->sq + params.sq_off.array);
+    ring->cqHead = (unsigned*)(ring->cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(ring->cq + params.cq_off.tail);
+    ring->cqMask = (unsigned*)(ring->cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(ring->cq + params.cq_off.cqes);
+    ring->tail = *ring->sqTail;
+    ring->queued = 0;
+    return true;
+}
+
+
+static void ESEM_Uring_Exit(esem_uring_t *ring)
+{
+    munmap(ring->sqes, ring->sqesLen);
+    if (ring->cq != ring->sq) {
+        munmap(ring->cq, ring->cqLen);
+    }
+    munmap(ring->sq, ring->sqLen);
+    close(ring->fd);
+}
+
+
+static struct io_uring_sqe* ESEM_Uring_Sqe(esem_uring_t *ring, unsigned char opcode, int fd, uint64_t userData)
+{ // Next submission entry, cleared, to be completed by the caller and submitted by the next ESEM_Uring_Enter. There is
+  // always one free: a transport has at most one operation of each kind in the ring
+
+    unsigned int index = ring->tail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = userData;
+    ring->sqArray[index] = index;
+    ring->tail++;
+    ring->queued++;
+    return sqe;
+}
+
+
+static int ESEM_Uring_Enter(esem_uring_t *ring, unsigned int minComplete)
+{ // Submits the queued entries and waits for minComplete completions in one system call
+
+    int rc;
+
+    __atomic_store_n(ring->sqTail, ring->tail, __ATOMIC_RELEASE);
+    do {
+        rc = (int)syscall(__NR_io_uring_enter, ring->fd, ring->queued, minComplete, (minComplete != 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (rc < 0 && errno == EINTR);
+    if (rc > 0) {
+        ring->queued -= (unsigned int)rc;
+    }
+    return rc;
+}
+
+
+static bool ESEM_Uring_Cqe(esem_uring_t *ring, struct io_uring_cqe *cqe)
+{ // Pops a completion, false if there is none
+
+    unsigned int head = *ring->cqHead;
+
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *cqe = ring->cqes[head & *ring->cqMask];
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+static void ESEM_Uring_Queue_Write(esem_transport_t *transport)
+{
+    struct io_uring_sqe *sqe = ESEM_Uring_Sqe(&transport->ring, IORING_OP_WRITE_FIXED, transport->fd, ESEM_OP_WRITE);
+    unsigned char *send = transport->buffer + ESEM_TRANSPORT_BUFFER_BYTES;
+
+    sqe->addr = (uintptr_t)(send + transport->sendPos);
+    sqe->len = (unsigned int)(transport->sendLen - transport->sendPos);
+    sqe->buf_index = 1;
+    transport->inflight |= 1 << ESEM_OP_WRITE;
+}
+
+
+static int ESEM_Uring_Complete(esem_transport_t *transport, unsigned int op)
+{ // Submits what is queued and reaps completions until op has completed. Returns its result, a negative errno on failure
+
+    struct io_uring_cqe cqe;
+
+    while (transport->inflight & (1 << op)) {
+        if (!ESEM_Uring_Cqe(&transport->ring, &cqe)) {
+            if (ESEM_Uring_Enter(&transport->ring, 1) < 0) {
+                return -errno;
+            }
+            continue;
+        }
+        if (cqe.user_data == ESEM_OP_WRITE && cqe.res > 0 && transport->sendPos + cqe.res < transport->sendLen) {
+            transport->sendPos += cqe.res;                                // Short write, the rest goes out with the next submission
+            ESEM_Uring_Queue_Write(transport);
+            continue;
+        }
+        if (cqe.user_data == ESEM_OP_WRITE) {
+            transport->sendLen = transport->sendPos = 0;
+        }
+        transport->inflight &= ~(1u << cqe.user_data);
+        transport->result[cqe.user_data] = cqe.res;
+    }
+    return transport->result[op];
+}
+
+
+static bool ESEM_Uring_Address(const char *endpoint, bool server, struct addrinfo **address)
+{ // Resolves tcp://host:port, where host is * for all interfaces
+
+    char host[256];
+    const char *colon;
+    struct addrinfo hints;
+
+    if (strncmp(endpoint, "tcp://", 6) != 0 || (colon = strrchr(endpoint, ':')) == NULL || colon - endpoint - 6 >= (long)sizeof(host)) {
+        return false;
+    }
+    memcpy(host, endpoint + 6, colon - endpoint - 6);
+    host[colon - endpoint - 6] = 0;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = server ? AI_PASSIVE : 0;
+    return getaddrinfo((strcmp(host, "*") == 0) ? NULL : host, colon + 1, &hints, address) == 0;
+}
+
+
+static bool ESEM_Uring_Open(esem_transport_t *transport, const char *endpoint)
+{
+    struct addrinfo *address;
+    struct iovec buffers[2];
+    int one = 1, fd;
+
+    if (!ESEM_Uring_Address(endpoint, transport->server, &address)) {
+        return false;
+    }
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && transport->server) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, address->ai_addr, address->ai_addrlen) != 0 || listen(fd, 16) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    } else if (fd >= 0) {
+        if (connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        } else {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));    // Requests and replies are single small writes
+        }
+    }
+    freeaddrinfo(address);
+    if (fd < 0) {
+        return false;
+    }
+    transport->listenFd = transport->server ? fd : -1;
+    transport->fd = transport->server ? -1 : fd;
+
+    transport->buffer = mmap(NULL, 2*ESEM_TRANSPORT_BUFFER_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (transport->buffer == MAP_FAILED || !ESEM_Uring_Setup(&transport->ring, ESEM_URING_ENTRIES)) {
+        if (transport->buffer != MAP_FAILED) {
+            munmap(transport->buffer, 2*ESEM_TRANSPORT_BUFFER_BYTES);
+        }
+        close(fd);
+        return false;
+    }
+    buffers[0].iov_base = transport->buffer;
+    buffers[0].iov_len = ESEM_TRANSPORT_BUFFER_BYTES;
+    buffers[1].iov_base = transport->buffer + ESEM_TRANSPORT_BUFFER_BYTES;
+    buffers[1].iov_len = ESEM_TRANSPORT_BUFFER_BYTES;
+    if (syscall(__NR_io_uring_register, transport->ring.fd, IORING_REGISTER_BUFFERS, buffers, 2) != 0) {
+        ESEM_Uring_Exit(&transport->ring);
+        munmap(transport->buffer, 2*ESEM_TRANSPORT_BUFFER_BYTES);
+        close(fd);
+        return false;
+    }
+    signal(SIGPIPE, SIG_IGN);                                             // A write to a verifier that went away fails with EPIPE instead
+    return true;
+}
+
+
+static int ESEM_Uring_Send(esem_transport_t *transport, const void *data, size_t len, bool more)
+{ // Appends a frame to the message being built. The last frame queues the write, which is submitted with the next receive
+
+    unsigned char *send = transport->buffer + ESEM_TRANSPORT_BUFFER_BYTES;
+    uint32_t header = (uint32_t)len | (more ? ESEM_FRAME_MORE : 0);
+
+    if (transport->fd < 0) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    if ((transport->inflight & (1 << ESEM_OP_WRITE)) && ESEM_Uring_Complete(transport, ESEM_OP_WRITE) < 0) {
+        transport->sendLen = transport->sendPos = 0;
+    }
+    if (len >= ESEM_FRAME_MORE || transport->sendLen + ESEM_FRAME_HEADER + len > ESEM_TRANSPORT_BUFFER_BYTES) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    send[transport->sendLen] = (unsigned char)header;                      // Little-endian whatever the host
+    send[transport->sendLen + 1] = (unsigned char)(header >> 8);
+    send[transport->sendLen + 2] = (unsigned char)(header >> 16);
+    send[transport->sendLen + 3] = (unsigned char)(header >> 24);
+    if (len != 0) {
+        memcpy(send + transport->sendLen + ESEM_FRAME_HEADER, data, len);
+    }
+    transport->sendLen += ESEM_FRAME_HEADER + len;
+    if (!more) {
+        ESEM_Uring_Queue_Write(transport);
+    }
+    return (int)len;
+}
+
+
+static void ESEM_Uring_Disconnect(esem_transport_t *transport)
+{ // Server side: drops the connection and anything half received from it, the next receive accepts another one
+
+    if (transport->inflight & (1 << ESEM_OP_WRITE)) {
+        ESEM_Uring_Complete(transport, ESEM_OP_WRITE);
+    }
+    close(transport->fd);
+    transport->fd = -1;
+    transport->recvLen = transport->recvPos = 0;
+    transport->sendLen = transport->sendPos = 0;
+}
+
+
+static int ESEM_Uring_Recv(esem_transport_t *transport, void *buf, size_t size, bool *more)
+{ // Returns the next frame, reading from the socket only when the buffer holds no complete frame. Like zmq_recv,
+  // the frame is truncated to size and its full length returned
+
+    unsigned char *recv = transport->buffer;
+    uint32_t header = 0, len;
+    struct io_uring_sqe *sqe;
+    int rc, one = 1;
+
+    while (1) {
+        if (transport->recvLen - transport->recvPos >= ESEM_FRAME_HEADER) {
+            header = (uint32_t)recv[transport->recvPos] | ((uint32_t)recv[transport->recvPos + 1] << 8) |
+                     ((uint32_t)recv[transport->recvPos + 2] << 16) | ((uint32_t)recv[transport->recvPos + 3] << 24);
+            len = header & ~ESEM_FRAME_MORE;
+            if (len > ESEM_TRANSPORT_BUFFER_BYTES - ESEM_FRAME_HEADER) {       // Not an ESEM peer
+                if (!transport->server) {
+                    errno = EPROTO;
+                    return -1;
+                }
+                ESEM_Uring_Disconnect(transport);
+                continue;
+            }
+            if (transport->recvLen - transport->recvPos >= ESEM_FRAME_HEADER + len) {
+                break;
+            }
+        }
+        if (transport->recvPos != 0) {                                    // Keep the partial frame at the front
+            memmove(recv, recv + transport->recvPos, transport->recvLen - transport->recvPos);
+            transport->recvLen -= transport->recvPos;
+            transport->recvPos = 0;
+        }
+
+        if (transport->fd < 0) {
+            ESEM_Uring_Sqe(&transport->ring, IORING_OP_ACCEPT, transport->listenFd, ESEM_OP_ACCEPT);
+            transport->inflight |= 1 << ESEM_OP_ACCEPT;
+            rc = ESEM_Uring_Complete(transport, ESEM_OP_ACCEPT);
+            if (rc < 0) {
+                errno = -rc;
+                return -1;
+            }
+            transport->fd = rc;
+            setsockopt(transport->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            continue;
+        }
+        sqe = ESEM_Uring_Sqe(&transport->ring, IORING_OP_READ_FIXED, transport->fd, ESEM_OP_READ);
+        sqe->addr = (uintptr_t)(recv + transport->recvLen);
+        sqe->len = (unsigned int)(ESEM_TRANSPORT_BUFFER_BYTES - transport->recvLen);
+        sqe->buf_index = 0;
+        transport->inflight |= 1 << ESEM_OP_READ;
+        rc = ESEM_Uring_Complete(transport, ESEM_OP_READ);                // Also submits a queued reply
+        if (rc <= 0) {
+            if (!transport->server) {
+                errno = (rc == 0) ? ECONNRESET : -rc;
+                return -1;
+            }
+            ESEM_Uring_Disconnect(transport);                             // The verifier is gone, wait for the next one
+            continue;
+        }
+        transport->recvLen += (size_t)rc;
+    }
+
+    memcpy(buf, recv + transport->recvPos + ESEM_FRAME_HEADER, (len < size) ? len : size);
+    transport->recvPos += ESEM_FRAME_HEADER + len;
+    *more = (header & ESEM_FRAME_MORE) != 0;
+    return (int)len;
+}
+
+
+static void ESEM_Uring_Close(esem_transport_t *transport)
+{ // Sends the queued reply, if any, before closing
+
+    if (transport->inflight & (1 << ESEM_OP_WRITE)) {
+        ESEM_Uring_Complete(transport, ESEM_OP_WRITE);
+    }
+    ESEM_Uring_Exit(&transport->ring);                                    // Also cancels a pending accept or read
+    munmap(transport->buffer, 2*ESEM_TRANSPORT_BUFFER_BYTES);
+    if (transport->fd >= 0) {
+        close(transport->fd);
+    }
+    if (transport->listenFd >= 0) {
+        close(transport->listenFd);
+    }
+}
+
+#else
+
+static bool ESEM_Uring_Open(esem_transport_t *transport, const char *endpoint)
+{ // The system headers do not know io_uring
+    (void)transport; (void)endpoint;
+    return false;
+}
+
+#define ESEM_Uring_Send NULL
+#define ESEM_Uring_Recv NULL
+#define ESEM_Uring_Close NULL
+
+#endif
+
+
+static void ESEM_Shm_Put(esem_shm_ring_t *ring, uint32_t pos, const void *src, size_t len)
+{ // Copies len bytes into the ring at stream position pos, wrapping around its end
+
+    size_t at = pos & (ESEM_SHM_RING_BYTES - 1), first = (len < ESEM_SHM_RING_BYTES - at) ? len : ESEM_SHM_RING_BYTES - at;
+
+    memcpy(ring->data + at, src, first);
+    memcpy(ring->data, (const unsigned char*)src + first, len - first);
+}
+
+
+static void ESEM_Shm_Get(esem_shm_ring_t *ring, uint32_t pos, void *dst, size_t len)
+{
+    size_t at = pos & (ESEM_SHM_RING_BYTES - 1), first = (len < ESEM_SHM_RING_BYTES - at) ? len : ESEM_SHM_RING_BYTES - at;
+
+    memcpy(dst, ring->data + at, first);
+    memcpy((unsigned char*)dst + first, ring->data, len - first);
+}
+
+
+static void ESEM_Shm_Wake(_Atomic uint32_t *word, _Atomic uint32_t *waiting)
+{ // Called after changing *word with a sequentially consistent store, so that either the waiter sees the change or
+  // its flag is seen here
+
+    if (atomic_load(waiting) != 0) {
+        syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+
+static bool ESEM_Shm_Peer_Alive(esem_transport_t *transport)
+{
+    unsigned char byte;
+    ssize_t rc;
+
+    if (atomic_load(&transport->shm->closed) != 0) {
+        return false;
+    }
+    rc = recv(transport->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return rc > 0 || (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+}
+
+
+static bool ESEM_Shm_Wait(esem_transport_t *transport, _Atomic uint32_t *word, uint32_t seen, _Atomic uint32_t *waiting)
+{ // Returns true once *word differs from seen: spins for a while, then sleeps on the futex. The sleep is cut every
+  // ESEM_SHM_WAIT_MS to notice a peer that died without closing. Returns false if the peer is gone
+
+    struct timespec timeout = {0, ESEM_SHM_WAIT_MS*1000000L};
+    unsigned int spin;
+
+    for (spin = 0; spin < transport->spin; spin++) {
+        if (atomic_load_explicit(word, memory_order_acquire) != seen) {
+            return true;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    while (1) {
+        atomic_store(waiting, 1);
+        if (atomic_load(word) != seen) {
+            break;
+        }
+        if (!ESEM_Shm_Peer_Alive(transport)) {
+            atomic_store(waiting, 0);
+            return false;
+        }
+        syscall(SYS_futex, word, FUTEX_WAIT, seen, &timeout, NULL, 0);
+    }
+    atomic_store(waiting, 0);
+    return true;
+}
+
+
+static void ESEM_Shm_Attach(esem_transport_t *transport, esem_shm_t *shm)
+{
+    transport->shm = shm;
+    transport->in = &shm->ring[transport->server ? 0 : 1];
+    transport->out = &shm->ring[transport->server ? 1 : 0];
+    transport->inHead = atomic_load(&transport->in->head);
+    transport->outTail = atomic_load(&transport->out->tail);
+    transport->sendLen = 0;
+}
+
+
+static void ESEM_Shm_Detach(esem_transport_t *transport)
+{ // Tells the peer, which may be sleeping on either ring, and unmaps the rings
+
+    atomic_store(&transport->shm->closed, 1);
+    syscall(SYS_futex, &transport->in->head, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    syscall(SYS_futex, &transport->out->tail, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    munmap(transport->shm, sizeof(esem_shm_t));
+    transport->shm = NULL;
+    close(transport->fd);
+    transport->fd = -1;
+}
+
+
+static bool ESEM_Shm_Address(const char *endpoint, struct sockaddr_un *address, socklen_t *len)
+{ // ipc://path is a unix socket path. tcp://host:port, kept so that the same endpoints work with every transport,
+  // is the abstract unix socket "esem-shm.port": both ends must be on the same host anyway
+
+    const char *colon;
+
+    memset(address, 0, sizeof(struct sockaddr_un));
+    address->sun_family = AF_UNIX;
+    if (strncmp(endpoint, "ipc://", 6) == 0 && strlen(endpoint + 6) < sizeof(address->sun_path)) {
+        strcpy(address->sun_path, endpoint + 6);
+        *len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + strlen(address->sun_path) + 1);
+        return true;
+    }
+    if (strncmp(endpoint, "tcp://", 6) == 0 && (colon = strrchr(endpoint, ':')) != NULL && strlen(colon + 1) < 32) {
+        snprintf(address->sun_path + 1, sizeof(address->sun_path) - 1, "esem-shm.%s", colon + 1);
+        *len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + strlen(address->sun_path + 1));
+        return true;
+    }
+    return false;
+}
+
+
+static bool ESEM_Shm_Accept(esem_transport_t *transport)
+{ // Server side: accepts a verifier, creates the rings in a memfd and passes its descriptor over the unix socket
+
+    struct msghdr message;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int))];
+    unsigned char byte = 0;
+    esem_shm_t *shm;
+    int fd, memfd;
+
+    fd = accept(transport->listenFd, NULL, NULL);
+    if (fd < 0) {
+        return false;
+    }
+    memfd = memfd_create("esem-shm", MFD_CLOEXEC);
+    if (memfd < 0 || ftruncate(memfd, sizeof(esem_shm_t)) != 0 ||
+        (shm = mmap(NULL, sizeof(esem_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, memfd, 0)) == MAP_FAILED) {
+        if (memfd >= 0) {
+            close(memfd);
+        }
+        close(fd);
+        return false;
+    }
+
+    memset(&message, 0, sizeof(message));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+    if (sendmsg(fd, &message, MSG_NOSIGNAL) != 1) {                        // The rings stay alive through the mappings
+        munmap(shm, sizeof(esem_shm_t));
+        close(memfd);
+        close(fd);
+        return false;
+    }
+    close(memfd);
+    transport->fd = fd;
+    ESEM_Shm_Attach(transport, shm);                                      // Zeroed by ftruncate: empty rings, not closed
+    return true;
+}
+
+
+static bool ESEM_Shm_Handshake(esem_transport_t *transport)
+{ // Verifier side: maps the rings passed by the server. Done on the first message rather than in Open, as a
+  // connection is only accepted when the server gets to its next Recv
+
+    struct msghdr message;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    char control[CMSG_SPACE(sizeof(int))];
+    unsigned char byte;
+    esem_shm_t *shm;
+    int memfd = -1;
+
+    memset(&message, 0, sizeof(message));
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(transport->fd, &message, MSG_CMSG_CLOEXEC) == 1 && (cmsg = CMSG_FIRSTHDR(&message)) != NULL &&
+        cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    if (memfd < 0) {
+        return false;
+    }
+    shm = mmap(NULL, sizeof(esem_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, memfd, 0);
+    close(memfd);
+    if (shm == MAP_FAILED) {
+        return false;
+    }
+    ESEM_Shm_Attach(transport, shm);
+    return true;
+}
+
+
+static bool ESEM_Shm_Open(esem_transport_t *transport, const char *endpoint)
+{
+    struct sockaddr_un address;
+    socklen_t len;
+    int fd;
+
+    if (!ESEM_Shm_Address(endpoint, &address, &len)) {
+        return false;
+    }
+    transport->spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? ESEM_SHM_SPIN : 0; // On one cpu the peer cannot run while we spin
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (transport->server) {
+        if (address.sun_path[0] != 0) {
+            unlink(address.sun_path);                                     // Left over by a previous server
+        }
+        if (bind(fd, (struct sockaddr*)&address, len) != 0 || listen(fd, 16) != 0) {
+            close(fd);
+            return false;
+        }
+        transport->listenFd = fd;
+        return true;
+    }
+
+    if (connect(fd, (struct sockaddr*)&address, len) != 0) {
+        close(fd);
+        return false;
+    }
+    transport->fd = fd;
+    return true;
+}
+
+
+static int ESEM_Shm_Send(esem_transport_t *transport, const void *data, size_t len, bool more)
+{ // Writes the frame behind the published tail, and publishes the whole message with its last frame
+
+    esem_shm_ring_t *ring;
+    uint32_t head, header = (uint32_t)len | (more ? ESEM_FRAME_MORE : 0);
+    unsigned char bytes[ESEM_FRAME_HEADER];
+
+    if (transport->shm == NULL && (transport->server || !ESEM_Shm_Handshake(transport))) {
+        errno = ENOTCONN;
+        return -1;
+    }
+    ring = transport->out;
+    if (len >= ESEM_FRAME_MORE || transport->sendLen + ESEM_FRAME_HEADER + len > ESEM_SHM_RING_BYTES) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    while ((uint32_t)(transport->outTail + ESEM_FRAME_HEADER + (uint32_t)len - (head = atomic_load_explicit(&ring->head, memory_order_acquire))) >
+           ESEM_SHM_RING_BYTES) {                                       // Stream positions are counted modulo 2^32
+        if (!ESEM_Shm_Wait(transport, &ring->head, head, &ring->producerWaiting)) {
+            errno = ECONNRESET;
+            return -1;
+        }
+    }
+    bytes[0] = (unsigned char)header;
+    bytes[1] = (unsigned char)(header >> 8);
+    bytes[2] = (unsigned char)(header >> 16);
+    bytes[3] = (unsigned char)(header >> 24);
+    ESEM_Shm_Put(ring, transport->outTail, bytes, ESEM_FRAME_HEADER);
+    ESEM_Shm_Put(ring, transport->outTail + ESEM_FRAME_HEADER, data, len);
+    transport->outTail += ESEM_FRAME_HEADER + (uint32_t)len;
+    transport->sendLen += ESEM_FRAME_HEADER + len;
+    if (!more) {
+        atomic_store(&ring->tail, transport->outTail);
+        ESEM_Shm_Wake(&ring->tail, &ring->consumerWaiting);
+        transport->sendLen = 0;
+    }
+    return (int)len;
+}
+
+
+static int ESEM_Shm_Recv(esem_transport_t *transport, void *buf, size_t size, bool *more)
+{
+    esem_shm_ring_t *ring;
+    uint32_t tail, header, len;
+    unsigned char bytes[ESEM_FRAME_HEADER];
+
+    while (1) {
+        if (transport->shm == NULL) {
+            if (!transport->server || !ESEM_Shm_Accept(transport)) {
+                errno = ENOTCONN;
+                return -1;
+            }
+        }
+        ring = transport->in;
+        while ((tail = atomic_load_explicit(&ring->tail, memory_order_acquire)) == transport->inHead) {
+            if (!ESEM_Shm_Wait(transport, &ring->tail, transport->inHead, &ring->consumerWaiting)) {
+                break;
+            }
+        }
+        if (tail != transport->inHead) {
+            break;
+        }
+        ESEM_Shm_Detach(transport);                                       // The peer is gone
+        if (!transport->server) {
+            errno = ECONNRESET;
+            return -1;
+        }
+    }
+
+    ESEM_Shm_Get(ring, transport->inHead, bytes, ESEM_FRAME_HEADER);
+    header = (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+    len = header & ~ESEM_FRAME_MORE;
+    if (len > tail - transport->inHead - ESEM_FRAME_HEADER) {             // Messages are published whole
+        errno = EPROTO;
+        return -1;
+    }
+    ESEM_Shm_Get(ring, transport->inHead + ESEM_FRAME_HEADER, buf, (len < size) ? len : size);
+    transport->inHead += ESEM_FRAME_HEADER + len;
+    atomic_store(&ring->head, transport->inHead);
+    ESEM_Shm_Wake(&ring->head, &ring->producerWaiting);
+    *more = (header & ESEM_FRAME_MORE) != 0;
+    return (int)len;
+}
+
+
+static void ESEM_Shm_Close(esem_transport_t *transport)
+{
+    if (transport->shm != NULL) {
+        ESEM_Shm_Detach(transport);
+    } else if (transport->fd >= 0) {
+        close(transport->fd);                                             // Connected, never sent
+    }
+    if (transport->listenFd >= 0) {
+        close(transport->listenFd);
+    }
+}
+
+
+static const esem_transport_ops_t ESEM_Transports[ESEM_TRANSPORTS] = {
+    {"zmq", ESEM_Zmq_Open, ESEM_Zmq_Send, ESEM_Zmq_Recv, ESEM_Zmq_Close},
+    {"io_uring", ESEM_Uring_Open, ESEM_Uring_Send, ESEM_Uring_Recv, ESEM_Uring_Close},
+    {"shm", ESEM_Shm_Open, ESEM_Shm_Send, ESEM_Shm_Recv, ESEM_Shm_Close},
+};
+
+
+static esem_transport_t* ESEM_Transport_Open(unsigned int kind, const char *endpoint, bool server)
+{
+    esem_transport_t *transport;
+
+    if (kind >= ESEM_TRANSPORTS) {
+        return NULL;
+    }
+    transport = calloc(1, sizeof(esem_transport_t));
+    if (transport == NULL) {
+        return NULL;
+    }
+    transport->ops = &ESEM_Transports[kind];
+    transport->server = server;
+    transport->listenFd = transport->fd = -1;
+    if (!transport->ops->open(transport, endpoint)) {
+        free(transport);
+        return NULL;
+    }
+    return transport;
+}
+
+
+esem_transport_t* ESEM_Transport_Bind(unsigned int kind, const char *endpoint)
+{
+    return ESEM_Transport_Open(kind, endpoint, true);
+}
+
+
+esem_transport_t* ESEM_Transport_Connect(unsigned int kind, const char *endpoint)
+{
+    return ESEM_Transport_Open(kind, endpoint, false);
+}
+
+
+int ESEM_Transport_Send(esem_transport_t *transport, const void *data, size_t len, bool more)
+{
+    return transport->ops->send(transport, data, len, more);
+}
+
+
+int ESEM_Transport_Recv(esem_transport_t *transport, void *buf, size_t size, bool *more)
+{
+    return transport->ops->recv(transport, buf, size, more);
+}
+
+
+void ESEM_Transport_Close(esem_transport_t *transport)
+{
+    if (transport == NULL) {
+        return;
+    }
+    transport->ops->close(transport);
+    free(transport);
+}
+
+
+const char* ESEM_Transport_Name(unsigned int kind)
+{
+    return (kind < ESEM_TRANSPORTS) ? ESEM_Transports[kind].name : "unknown";
+}
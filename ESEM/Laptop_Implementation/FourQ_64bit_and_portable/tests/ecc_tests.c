@@ -22,6 +22,44 @@
     #define SHORT_BENCH_LOOPS 10000
 #endif
 #define TEST_LOOPS            1000       // Number of iterations per test
+#define BATCH_POINTS          16         // Maximum number of points per batch normalization test
+
+
+static void precomp_lanes(point_precomp_t *VV, point_precomp *lanes[][BATCH_POINTS], point_precomp **QQ[], unsigned int nlanes, unsigned int npoints)
+{ // Fills nlanes lanes of npoints points drawn at random from VV, repeated points included, and points QQ to them
+    uint64_t scalar[4];
+    unsigned int i, k;
+
+    for (k=0; k<nlanes; k++)
+    {
+        if (k%4 == 0) random_scalar_test(scalar);
+        for (i=0; i<npoints; i++)
+        {
+            lanes[k][i] = VV[(scalar[k%4] >> 4*i) % BATCH_POINTS];
+        }
+        QQ[k] = lanes[k];
+    }
+}
+
+
+static bool precomp_sum_check(point_precomp **lane, unsigned int npoints, point_t R)
+{ // Compares R, in affine coordinates, with the sum of the npoints points of lane computed with eccmadd_ni
+    point_extproj_t P;
+    point_t A, B;
+    unsigned int i;
+
+    R5_to_R1(lane[0], P);
+    for (i=1; i<npoints; i++)
+    {
+        eccmadd_ni(lane[i], P);
+    }
+    eccnorm(P, A);
+    fp2copy1271(R->x, B->x);
+    fp2copy1271(R->y, B->y);
+    mod1271(A->x[0]); mod1271(A->x[1]); mod1271(A->y[0]); mod1271(A->y[1]);
+    mod1271(B->x[0]); mod1271(B->x[1]); mod1271(B->y[0]); mod1271(B->y[1]);
+    return fp2compare64((uint64_t*)A->x,(uint64_t*)B->x)==0 && fp2compare64((uint64_t*)A->y,(uint64_t*)B->y)==0;
+}
 
 
 bool ecc_test()
@@ -32,6 +70,7 @@ bool ecc_test()
     point_t A;
     point_extproj_t P;
     point_extproj_precomp_t Q;
+    point_precomp_t V;
     f2elm_t t1;
     uint64_t scalar[4], res_x[4], res_y[4];
 
@@ -115,6 +154,138 @@ bool ecc_test()
     if (passed==1) printf("  Point addition tests .................................................................... PASSED");
     else { printf("  Point addition tests ... FAILED"); printf("\n"); return false; }
     printf("\n");
+
+    // Mixed point addition
+    eccset(A); 
+    point_setup_precomp(A, V);             // V = (x+y,y-x,2dt)
+    R5_to_R1(V, P);
+    eccdouble(P);                          // P = 2P 
+
+    for (n=0; n<TEST_LOOPS; n++)
+    {
+        eccmadd_ni(V, P);                  // P = P+V
+    }    
+    eccnorm(P, A);
+    mod1271(A->x[0]); mod1271(A->x[1]);    // Fully reduced P
+    mod1271(A->y[0]); mod1271(A->y[1]);    
+
+    // Result
+    res_x[0] = 0x6480B1EF0A151DB0; res_x[1] = 0x3E243958590C4D90; res_x[2] = 0xAA270F644A65D473; res_x[3] = 0x5327AF7D84238CD0;
+    res_y[0] = 0x5E06003D73C43EB1; res_y[1] = 0x3EF69A49CB7E0237; res_y[2] = 0x4E752648AC2EF0AB; res_y[3] = 0x293EB1E26DD23B4E;
+
+    if (fp2compare64((uint64_t*)A->x, res_x)!=0 || fp2compare64((uint64_t*)A->y, res_y)!=0) passed=0;
+
+    if (passed==1) printf("  Mixed point addition tests .............................................................. PASSED");
+    else { printf("  Mixed point addition tests ... FAILED"); printf("\n"); return false; }
+    printf("\n");
+
+    {
+    point_extproj_t PP[BATCH_POINTS];
+    point_t AA[BATCH_POINTS], BB;
+
+    // Batch normalization
+    for (n=0; n<TEST_LOOPS/BATCH_POINTS; n++)
+    {
+        unsigned int i, npoints = 1 + n%BATCH_POINTS;
+
+        for (i=0; i<npoints; i++)
+        {
+            random_scalar_test(scalar);
+            eccset(A);
+            ecc_mul(A, (digit_t*)scalar, A, false);
+            point_setup(A, PP[i]);
+            eccdouble(PP[i]);                  // Projective point with Z != 1
+        }
+        eccnorm_batch(PP, AA, npoints);
+
+        for (i=0; i<npoints; i++)
+        {
+            eccnorm(PP[i], BB);
+            if (fp2compare64((uint64_t*)AA[i]->x,(uint64_t*)BB->x)!=0 || fp2compare64((uint64_t*)AA[i]->y,(uint64_t*)BB->y)!=0) { passed=0; break; }
+        }
+    }
+    }
+
+    if (passed==1) printf("  Batch normalization tests ............................................................... PASSED");
+    else { printf("  Batch normalization tests ... FAILED"); printf("\n"); return false; }
+    printf("\n");
+
+    {
+    point_t AA[BATCH_POINTS], BB;
+    point_precomp_t VV[BATCH_POINTS];
+    point_precomp *lanes[MADD_MAX_LANES][BATCH_POINTS], **QQ[MADD_MAX_LANES];
+    point_extproj_t RR[MADD_MAX_LANES];
+    unsigned int i, k;
+
+    // Four-way sums of precomputed points
+    for (i=0; i<BATCH_POINTS; i++)
+    {
+        random_scalar_test(scalar);
+        eccset(A);
+        ecc_mul(A, (digit_t*)scalar, AA[i], false);
+        point_setup_precomp(AA[i], VV[i]);
+    }
+    for (n=0; n<TEST_LOOPS/BATCH_POINTS; n++)
+    {
+        unsigned int npoints = 1 + n%BATCH_POINTS;
+
+        precomp_lanes(VV, lanes, QQ, 4, npoints);
+        eccmadd_sum_x4(QQ, npoints, RR);
+
+        for (k=0; k<4; k++)
+        {
+            eccnorm(RR[k], BB);
+            if (!precomp_sum_check(lanes[k], npoints, BB)) { passed=0; break; }
+        }
+    }
+
+    if (passed==1) printf("  Four-way mixed addition tests ........................................................... PASSED");
+    else { printf("  Four-way mixed addition tests ... FAILED"); printf("\n"); return false; }
+    printf("\n");
+
+    // Interleaved sums of precomputed points, 1 to MADD_MAX_LANES lanes
+    for (n=0; n<TEST_LOOPS/BATCH_POINTS; n++)
+    {
+        unsigned int npoints = 1 + n%BATCH_POINTS, nlanes = 1 + n%MADD_MAX_LANES;
+
+        precomp_lanes(VV, lanes, QQ, nlanes, npoints);
+        eccmadd_sum_interleaved(QQ, nlanes, npoints, RR);
+
+        for (k=0; k<nlanes; k++)
+        {
+            eccnorm(RR[k], BB);
+            if (!precomp_sum_check(lanes[k], npoints, BB)) { passed=0; break; }
+        }
+    }
+
+    if (passed==1) printf("  Interleaved mixed addition tests ........................................................ PASSED");
+    else { printf("  Interleaved mixed addition tests ... FAILED"); printf("\n"); return false; }
+    printf("\n");
+
+    {
+    point_precomp work[MADD_MAX_LANES*((BATCH_POINTS+1)/2)];
+    f2elm_t scratch[3*MADD_MAX_LANES*(BATCH_POINTS/2)];
+    point_t CC[MADD_MAX_LANES];
+
+    // Batched affine sums of precomputed points, 1 to MADD_MAX_LANES sums
+    for (n=0; n<TEST_LOOPS/BATCH_POINTS; n++)
+    {
+        unsigned int npoints = 1 + n%BATCH_POINTS, nsums = 1 + (n/BATCH_POINTS)%MADD_MAX_LANES;
+
+        precomp_lanes(VV, lanes, QQ, nsums, npoints);
+        ecc_sum_affine_batch(QQ, nsums, npoints, CC, work, scratch);
+
+        for (k=0; k<nsums; k++)
+        {
+            if (!precomp_sum_check(lanes[k], npoints, CC[k])) { passed=0; break; }
+        }
+    }
+    }
+    }
+
+    if (passed==1) printf("  Affine batch sum tests .................................................................. PASSED");
+    else { printf("  Affine batch sum tests ... FAILED"); printf("\n"); return false; }
+    printf("\n");
    
 #if (USE_ENDO == true)
     // Psi endomorphism
@@ -322,6 +493,26 @@ bool ecc_test()
     if (passed==1) printf("  Double scalar multiplication tests ...................................................... PASSED");
     else { printf("  Double scalar multiplication tests ... FAILED"); printf("\n"); return false; }
     printf("\n");
+
+    // Double scalar multiplication in projective coordinates and projective equality
+    for (n=0; n<TEST_LOOPS; n++)
+    {
+        random_scalar_test(k); 
+        random_scalar_test(l); 
+        ecc_mul_double((digit_t*)k, QQ, (digit_t*)l, RR);
+        ecc_mul_double_extproj((digit_t*)k, QQ, (digit_t*)l, BB);
+        point_setup(RR, P);
+
+        if (ecc_equal_extproj(P, BB) == false || ecc_equal_extproj(BB, P) == false) { passed=0; break; }
+        eccdouble(P);                                          // 2R != R
+        if (ecc_equal_extproj(P, BB) == true) { passed=0; break; }
+    }
+    fp2zero1271(P->x); fp2zero1271(P->y); fp2zero1271(P->z);    // Degenerate (0:0:0) must not compare equal
+    if (ecc_equal_extproj(P, BB) == true || ecc_equal_extproj(BB, P) == true) passed=0;
+
+    if (passed==1) printf("  Projective double scalar multiplication tests ........................................... PASSED");
+    else { printf("  Projective double scalar multiplication tests ... FAILED"); printf("\n"); return false; }
+    printf("\n");
     }
 
     return OK;
@@ -0,0 +1,96 @@
+/***********************************************************************************
+* ESEM: Energy-Aware Signature for Embedded Medical Devices
+*
+* Abstract: testing code for the message transports
+************************************************************************************/
+
+#include "ESEM_transport.c"                // The tests reach into the shared-memory rings
+
+
+#define TEST_LOOPS            2000       // Number of rounds per test
+#define TEST_FRAMES           3          // Frames per message
+#define TEST_START            0xFFFFFF80 // Ring positions at the start of the test, just below 2^32
+
+
+static unsigned char test_byte(unsigned int message, unsigned int frame, unsigned int i)
+{
+    return (unsigned char)(message*31 + frame*7 + i);
+}
+
+
+bool shm_wrap_test()
+{ // Messages through a shared-memory ring whose positions wrap around 2^32. Both ends are in this thread, with no
+  // peer socket, so a send that would wait for room fails instead of blocking
+    esem_shm_t *shm = calloc(1, sizeof(esem_shm_t));
+    esem_transport_t producer, consumer;
+    unsigned char frame[ESEM_PROJ_BYTES*8], got[ESEM_PROJ_BYTES*8];
+    size_t size[TEST_FRAMES] = {ESEM_REQUEST_BYTES, ESEM_PROJ_BYTES*8, ESEM_COMPRESSED_BYTES};
+    unsigned int n, batch, m, f, i;
+    bool more, passed = true;
+    int rc;
+
+    if (shm == NULL) {
+        return false;
+    }
+    memset(&producer, 0, sizeof(producer));
+    memset(&consumer, 0, sizeof(consumer));
+    atomic_init(&shm->ring[0].head, TEST_START);
+    atomic_init(&shm->ring[0].tail, TEST_START);
+    producer.server = false;                       // Writes ring[0]
+    consumer.server = true;                        // Reads ring[0]
+    ESEM_Shm_Attach(&producer, shm);
+    ESEM_Shm_Attach(&consumer, shm);
+    producer.fd = consumer.fd = -1;
+
+    printf("\n--------------------------------------------------------------------------------------------------------\n\n");
+    printf("Testing ESEM's transports: \n\n");
+
+    for (n = 0; n < TEST_LOOPS && passed; n++) {
+        batch = 1 + n%(ESEM_SHM_RING_BYTES/(ESEM_PROJ_BYTES*8 + 64 + 3*ESEM_FRAME_HEADER));  // Up to a full ring
+        for (m = 0; m < batch && passed; m++) {
+            for (f = 0; f < TEST_FRAMES; f++) {
+                for (i = 0; i < size[f]; i++) {
+                    frame[i] = test_byte(n + m, f, i);
+                }
+                if (ESEM_Shm_Send(&producer, frame, size[f], f+1 < TEST_FRAMES) != (int)size[f]) {
+                    passed = false;
+                    break;
+                }
+            }
+        }
+        for (m = 0; m < batch && passed; m++) {
+            for (f = 0; f < TEST_FRAMES; f++) {
+                rc = ESEM_Shm_Recv(&consumer, got, sizeof(got), &more);
+                if (rc != (int)size[f] || more != (f+1 < TEST_FRAMES)) {
+                    passed = false;
+                    break;
+                }
+                for (i = 0; i < size[f]; i++) {
+                    if (got[i] != test_byte(n + m, f, i)) {
+                        passed = false;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    if (producer.outTail >= TEST_START) {          // The positions must have wrapped
+        passed = false;
+    }
+    free(shm);
+
+    if (passed) printf("  Shared-memory ring wrap tests ........................................................... PASSED");
+    else { printf("  Shared-memory ring wrap tests ... FAILED"); printf("\n"); return false; }
+    printf("\n");
+    return true;
+}
+
+
+int main()
+{
+    bool OK = true;
+
+    OK = OK && shm_wrap_test();      // Test the shared-memory transport across the wrap of its ring positions
+
+    return OK;
+}